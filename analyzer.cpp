@@ -1,14 +1,121 @@
 #include "analyzer.h"
+#include "mapped_file.h"
+#include "topk.h"
 #include <cstring>
 #include <cstdio>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 using namespace std;
 
-TripAnalyzer::ZoneStats::ZoneStats() : total(0) {
+TripAnalyzer::ZoneStats::ZoneStats() {
     memset(byHour, 0, sizeof(byHour));
 }
 
+void TripAnalyzer::Aggregate::clear() {
+    names.clear();
+    names.reserve(100000);
+    stats.clear();
+    hourCarries.clear();
+    routes.clear();
+    days.clear();
+    dayCube.clear();
+    slots.clear();
+    fares.clear();
+    distances.clear();
+    rowZones.clear();
+    rowHours.clear();
+    counters = IngestStats();
+    rankings = RankingCache();
+    leaders.reset(leaders.capacity());
+    approx.clear();
+}
+
+uint32_t TripAnalyzer::Aggregate::zoneId(const char* name, size_t len, uint64_t hash) {
+    uint32_t id = names.intern(name, len, hash);
+    if (id == stats.size()) stats.emplace_back();
+    return id;
+}
+
+void TripAnalyzer::Aggregate::addTrip(uint32_t id, int hour) {
+    if (++stats[id].byHour[hour] == 0) ++hourCarries[id][hour];
+    bumpLeader(id);
+    if (keepRows) {
+        rowZones.push_back(id);
+        rowHours.push_back((uint8_t)hour);
+    }
+}
+
+void TripAnalyzer::Aggregate::addHourCount(uint32_t id, int hour, uint64_t n) {
+    ZoneStats& zone = stats[id];
+    uint64_t low = (uint64_t)zone.byHour[hour] + (uint32_t)n;
+    zone.byHour[hour] = (uint32_t)low;
+    uint64_t carry = (n >> 32) + (low >> 32);
+    if (carry) hourCarries[id][hour] += carry;
+    if (n) bumpLeader(id);
+}
+
+void TripAnalyzer::Aggregate::trackLeaders(size_t k) {
+    leaders.reset(k);
+    for (uint32_t id = 0; id < (uint32_t)stats.size(); ++id) {
+        if (total(id) > 0) bumpLeader(id);
+    }
+}
+
+long long TripAnalyzer::Aggregate::hourCount(uint32_t id, int hour) const {
+    uint64_t n = stats[id].byHour[hour];
+    if (const uint64_t* carries = carriesOf(id)) n += carries[hour] << 32;
+    return (long long)n;
+}
+
+uint64_t TripAnalyzer::Aggregate::total(uint32_t id) const {
+    uint64_t n = 0;
+    for (uint32_t count : stats[id].byHour) n += count;
+    if (const uint64_t* carries = carriesOf(id)) {
+        for (int h = 0; h < 24; ++h) n += carries[h] << 32;
+    }
+    return n;
+}
+
+void TripAnalyzer::Aggregate::merge(const Aggregate& other) {
+    TRIP_STATS_PHASE(counters, MERGE);
+    if (IngestStats::enabled) {
+        counters.add(other.counters);
+        other.names.addProbeStats(counters);
+    }
+
+    vector<uint32_t> remap(other.names.size());
+    for (uint32_t otherId = 0; otherId < (uint32_t)other.names.size(); ++otherId) {
+        string_view name = other.names.name(otherId);
+        uint32_t id = zoneId(name.data(), name.size(), other.names.hashOf(otherId));
+        remap[otherId] = id;
+
+        for (int h = 0; h < 24; ++h) addHourCount(id, h, (uint64_t)other.hourCount(otherId, h));
+
+        if (other.fares.hasZone(otherId)) fares.mergeZone(id, other.fares, otherId);
+        if (other.distances.hasZone(otherId)) distances.mergeZone(id, other.distances, otherId);
+    }
+    other.routes.forEach([&](uint64_t key, long long count) {
+        routes.add(RouteTable::key(remap[RouteTable::pickupOf(key)], remap[RouteTable::dropoffOf(key)]), count);
+    });
+    auto addDay = [&](uint64_t key, long long count) {
+        days.add(DayTable::key(remap[DayTable::zoneOf(key)], DayTable::dayOf(key), DayTable::hourOf(key)), count);
+    };
+    other.dayCube.forEach(addDay);
+    other.days.forEach(addDay);
+    other.slots.forEach([&](uint64_t key, long long count) {
+        slots.add(SlotTable::key(remap[SlotTable::zoneOf(key)], SlotTable::slotOf(key)), count);
+    });
+    if (keepRows) {
+        for (uint32_t otherId : other.rowZones) rowZones.push_back(remap[otherId]);
+        rowHours.insert(rowHours.end(), other.rowHours.begin(), other.rowHours.end());
+    }
+}
+
 static bool isWhitespace(unsigned char c) { 
     return c <= 32; 
 }
@@ -23,6 +130,13 @@ static void cleanBounds(const char*& start, const char*& end) {
     }
 }
 
+#if TRIP_ANALYZER_STATS
+static bool isBlankLine(const char* start, const char* end) {
+    while (start < end && isWhitespace(*start)) ++start;
+    return start == end;
+}
+#endif
+
 static void skipBOM(const char*& start, const char*& end) {
     if (end - start >= 3 &&
         (unsigned char)start[0] == 0xEF &&
@@ -30,43 +144,161 @@ static void skipBOM(const char*& start, const char*& end) {
         (unsigned char)start[2] == 0xBF) start += 3;
 }
 
-static bool parseThreeFields(const char* lineStart, const char* lineEnd,
-                             const char*& field0Start, const char*& field0End,
-                             const char*& field1Start, const char*& field1End,
-                             const char*& field2Start, const char*& field2End) {
-    const void* hasQuote = memchr(lineStart, '"', lineEnd - lineStart);
-    
-    if (!hasQuote) {
-        const char* comma1 = (const char*)memchr(lineStart, ',', lineEnd - lineStart);
-        if (!comma1) return false;
-        const char* comma2 = (const char*)memchr(comma1 + 1, ',', lineEnd - (comma1 + 1));
-        if (!comma2) return false;
-        
-        field0Start = lineStart; field0End = comma1;
-        field1Start = comma1 + 1; field1End = comma2;
-        field2Start = comma2 + 1; field2End = lineEnd;
-        return true;
+// Splits [start, end) at commas outside quotes into at most maxFields
+// fields and returns how many it found. The last field stops at the next
+// comma, so columns after it are never looked at.
+static int splitFields(const char* start, const char* end, int maxFields, CsvField* fields) {
+    int count = 0;
+    if (!memchr(start, '"', end - start)) {
+        while (count < maxFields) {
+            const char* comma = (const char*)memchr(start, ',', end - start);
+            if (!comma) {
+                fields[count++] = CsvField{start, end};
+                break;
+            }
+            fields[count++] = CsvField{start, comma};
+            start = comma + 1;
+        }
+        return count;
     }
-    
+
     bool inQuote = false;
-    int fieldIndex = 0;
-    const char* fieldStart = lineStart;
-    
-    for (const char* p = lineStart; p <= lineEnd; ++p) {
-        if (p < lineEnd && *p == '"') inQuote = !inQuote;
-        
-        if (!inQuote && (p == lineEnd || *p == ',')) {
-            if (fieldIndex == 0) { field0Start = fieldStart; field0End = p; }
-            else if (fieldIndex == 1) { field1Start = fieldStart; field1End = p; }
-            else if (fieldIndex == 2) { field2Start = fieldStart; field2End = p; return true; }
-            
-            ++fieldIndex;
+    const char* fieldStart = start;
+    for (const char* p = start; p <= end && count < maxFields; ++p) {
+        if (p < end && *p == '"') inQuote = !inQuote;
+        if (!inQuote && (p == end || *p == ',')) {
+            fields[count++] = CsvField{fieldStart, p};
             fieldStart = p + 1;
         }
     }
+    return count;
+}
+
+// Header names are compared lower-case with everything but letters and
+// digits dropped, so "PickupZoneID", "pickup_zone_id" and "Pickup Zone ID"
+// all name the same column.
+namespace {
+struct HeaderName {
+    const char* name;
+    int TripColumnMap::*column;
+};
+
+const HeaderName HEADER_NAMES[] = {
+    {"tripid", &TripColumnMap::tripId},
+    {"id", &TripColumnMap::tripId},
+    {"pickupzoneid", &TripColumnMap::pickupZone},
+    {"pickupzone", &TripColumnMap::pickupZone},
+    {"pickuplocationid", &TripColumnMap::pickupZone},
+    {"pulocationid", &TripColumnMap::pickupZone},
+    {"dropoffzoneid", &TripColumnMap::dropoffZone},
+    {"dropoffzone", &TripColumnMap::dropoffZone},
+    {"dropofflocationid", &TripColumnMap::dropoffZone},
+    {"dolocationid", &TripColumnMap::dropoffZone},
+    {"pickuptime", &TripColumnMap::pickupTime},
+    {"pickupdatetime", &TripColumnMap::pickupTime},
+    {"tpeppickupdatetime", &TripColumnMap::pickupTime},
+    {"lpeppickupdatetime", &TripColumnMap::pickupTime},
+    {"distance", &TripColumnMap::distance},
+    {"distancekm", &TripColumnMap::distance},
+    {"tripdistance", &TripColumnMap::distance},
+    {"fare", &TripColumnMap::fare},
+    {"fareamount", &TripColumnMap::fare},
+};
+}  // namespace
+
+static int* headerColumn(TripColumnMap& columns, const char* begin, const char* end) {
+    char name[32];
+    size_t len = 0;
+    for (const char* p = begin; p < end; ++p) {
+        char c = *p;
+        if (c >= 'A' && c <= 'Z') c = (char)(c - 'A' + 'a');
+        if ((c < 'a' || c > 'z') && (c < '0' || c > '9')) continue;
+        if (len + 1 == sizeof(name)) return nullptr;
+        name[len++] = c;
+    }
+    name[len] = 0;
+    for (const HeaderName& h : HEADER_NAMES) {
+        if (strcmp(name, h.name) == 0) return &(columns.*h.column);
+    }
+    return nullptr;
+}
+
+// Recognizes a header line and maps its columns. A line is a header if its
+// first field is "TripID" or if it names both the pickup zone and the pickup
+// time; required columns it does not name keep their default positions.
+static bool readHeader(const CsvField* fields, int fieldCount, TripColumnMap& columns) {
+    TripColumnMap named;
+    named.tripId = named.pickupZone = named.pickupTime = -1;
+    for (int i = 0; i < fieldCount; ++i) {
+        const char* start = fields[i].begin;
+        const char* end = fields[i].end;
+        cleanBounds(start, end);
+        int* column = headerColumn(named, start, end);
+        if (column && *column < 0) *column = i;
+    }
+
+    const char* idStart = fields[0].begin;
+    const char* idEnd = fields[0].end;
+    cleanBounds(idStart, idEnd);
+    bool legacy = idEnd - idStart == 6 && memcmp(idStart, "TripID", 6) == 0;
+    if (!legacy && (named.pickupZone < 0 || named.pickupTime < 0)) return false;
+
+    TripColumnMap defaults;
+    if (named.tripId < 0) named.tripId = defaults.tripId;
+    if (named.pickupZone < 0) named.pickupZone = defaults.pickupZone;
+    if (named.pickupTime < 0) named.pickupTime = defaults.pickupTime;
+    columns = named;
+    return true;
+}
+
+static bool looksLikeTimestamp(const CsvField& field) {
+    const char* start = field.begin;
+    const char* end = field.end;
+    cleanBounds(start, end);
+    if (end - start < 13) return false;
+    for (int i : {0, 1, 2, 3, 5, 6, 8, 9, 11, 12}) {
+        if ((unsigned)(start[i] - '0') > 9u) return false;
+    }
+    return start[4] == '-' && start[7] == '-';
+}
+
+// Layout of a headerless file from one data row: the first column from 2 on
+// that holds a timestamp is the pickup time. When that is column 3, column 2
+// is the dropoff zone and distance and fare follow, as in SmallTrips.csv.
+static bool inferColumns(const CsvField* fields, int fieldCount, TripColumnMap& columns) {
+    for (int i = 2; i < fieldCount; ++i) {
+        if (!looksLikeTimestamp(fields[i])) continue;
+        columns = TripColumnMap();
+        columns.pickupTime = i;
+        if (i == 3) {
+            columns.dropoffZone = 2;
+            if (fieldCount > 4) columns.distance = 4;
+            if (fieldCount > 5) columns.fare = 5;
+        }
+        return true;
+    }
     return false;
 }
 
+static bool extractHourValue(const char* timeStart, const char* timeEnd, int& hourOut);
+
+// Whether a row is a valid trip under `columns`, the dropoff zone included
+// when there is one. An inferred layout is only adopted from such a row, so
+// a dirty first row cannot settle the layout for the whole file.
+static bool fitsColumns(const CsvField* fields, int fieldCount, const TripColumnMap& columns) {
+    int hour;
+    for (int i : {columns.tripId, columns.pickupZone, columns.dropoffZone}) {
+        if (i < 0) continue;
+        if (i >= fieldCount) return false;
+        const char* start = fields[i].begin;
+        const char* end = fields[i].end;
+        cleanBounds(start, end);
+        if (start >= end) return false;
+    }
+    return columns.pickupTime < fieldCount &&
+           extractHourValue(fields[columns.pickupTime].begin, fields[columns.pickupTime].end, hour);
+}
+
 static bool extractHourValue(const char* timeStart, const char* timeEnd, int& hourOut) {
     const char* start = timeStart;
     const char* end = timeEnd;
@@ -86,185 +318,1215 @@ static bool extractHourValue(const char* timeStart, const char* timeEnd, int& ho
     return true;
 }
 
-void TripAnalyzer::ingestFile(const string& csvPath) {
-    FILE* file = fopen(csvPath.c_str(), "rb");
-    if (!file) return;
+// Days since 1970-01-01 of the "YYYY-MM-DD" at the start of s (at least 10
+// bytes), or -1 unless that is a real date from 1970 to 2149 (16-bit day
+// numbers). Every check is folded into one flag and the day number is the
+// closed-form civil-calendar count, so a row costs no library call and no
+// data-dependent branch.
+static int parseDay(const char* s) {
+    unsigned y0 = (unsigned)(s[0] - '0'), y1 = (unsigned)(s[1] - '0'), y2 = (unsigned)(s[2] - '0'),
+             y3 = (unsigned)(s[3] - '0'), m0 = (unsigned)(s[5] - '0'), m1 = (unsigned)(s[6] - '0'),
+             d0 = (unsigned)(s[8] - '0'), d1 = (unsigned)(s[9] - '0');
+    unsigned bad = (y0 > 9) | (y1 > 9) | (y2 > 9) | (y3 > 9) | (m0 > 9) | (m1 > 9) | (d0 > 9) | (d1 > 9) |
+                   (s[4] != '-') | (s[7] != '-');
+    int year = (int)(y0 * 1000 + y1 * 100 + y2 * 10 + y3);
+    unsigned month = m0 * 10 + m1, day = d0 * 10 + d1;
+
+    unsigned leap = (year % 4 == 0) & ((year % 100 != 0) | (year % 400 == 0));
+    unsigned monthDays = 28 + ((0x3bbeeccu >> (month * 2 & 31)) & 3) + (leap & (month == 2));
+    bad |= (month - 1 > 11u) | (day - 1 >= monthDays);
+
+    // Years start in March, so the leap day is the last day of a year.
+    int y = year - (month <= 2);
+    unsigned shifted = month + (month > 2 ? -3 : 9);
+    int dayOfYear = (int)((153 * shifted + 2) / 5 + day - 1);
+    int days = y * 365 + y / 4 - y / 100 + y / 400 + dayOfYear - 719468;
+    bad |= (unsigned)days > 0xFFFFu;
+    return bad ? -1 : days;
+}
+
+// Minute of an "...HH:MM" time (at least 13 bytes), or -1.
+static int parseMinute(const char* start, const char* end) {
+    if (end - start < 16 || start[13] != ':') return -1;
+    unsigned m0 = (unsigned)(start[14] - '0'), m1 = (unsigned)(start[15] - '0');
+    if (m0 > 5 || m1 > 9) return -1;
+    return (int)(m0 * 10 + m1);
+}
+
+// Monday = 0.
+static int weekdayOf(int day) {
+    return (day + 3) % 7;
+}
+
+// Decimal with optional sign and fraction, as hundredths: "12" -> 1200,
+// "-3.75" -> -375, "0.125" -> 13 (a third fractional digit rounds, later
+// ones are ignored). No strtod, so no locale and no rounding error on the
+// two-decimal values trip files hold. Empty fields, stray characters and
+// values beyond int32 are invalid.
+static bool parseHundredths(const char* start, const char* end, int32_t& out) {
+    cleanBounds(start, end);
+    bool negative = false;
+    if (start < end && (*start == '-' || *start == '+')) {
+        negative = *start == '-';
+        ++start;
+    }
+
+    int64_t whole = 0;
+    int digits = 0;
+    for (; start < end && (unsigned)(*start - '0') <= 9u; ++start, ++digits) {
+        whole = whole * 10 + (*start - '0');
+        if (whole > INT32_MAX) return false;
+    }
+
+    int64_t fraction = 0;
+    int fractionDigits = 0;
+    bool roundUp = false;
+    if (start < end && *start == '.') {
+        for (++start; start < end && (unsigned)(*start - '0') <= 9u; ++start, ++fractionDigits) {
+            if (fractionDigits < 2) fraction = fraction * 10 + (*start - '0');
+            else if (fractionDigits == 2) roundUp = *start >= '5';
+        }
+    }
+    if (start != end || digits + fractionDigits == 0) return false;
+    if (fractionDigits == 1) fraction *= 10;
+
+    int64_t value = whole * 100 + fraction + (roundUp ? 1 : 0);
+    if (value > INT32_MAX) return false;
+    out = (int32_t)(negative ? -value : value);
+    return true;
+}
+
+void TripAnalyzer::ingestLine(const char* lineStart, const char* lineEnd, LineState& state,
+                              Aggregate& into) {
+    TRIP_STATS_PHASE(into.counters, PARSE);
+    TRIP_STATS_INC(into.counters, linesSeen);
+
+    if (lineEnd > lineStart && lineEnd[-1] == '\r') --lineEnd;
+    if (lineEnd <= lineStart) {
+        TRIP_STATS_INC(into.counters, rejectedBlank);
+        return;
+    }
+
+    const char* start = lineStart;
+    const char* end = lineEnd;
+
+    while (start < end && isWhitespace(*start)) ++start;
+    if (start >= end) {
+        TRIP_STATS_INC(into.counters, rejectedBlank);
+        return;
+    }
+
+    if (!state.bomProcessed) {
+        skipBOM(start, end);
+        state.bomProcessed = true;
+    }
+    while (start < end && isWhitespace(*start)) ++start;
+    if (start >= end) {
+        TRIP_STATS_INC(into.counters, rejectedBlank);
+        return;
+    }
+
+    TRIP_STATS_ADD(into.counters, quotedLines, memchr(start, '"', end - start) != nullptr);
+    CsvField fields[TripColumnMap::MAX_COLUMNS];
+    int fieldCount = splitFields(start, end, state.lastField + 1, fields);
+    ingestFields(fields, fieldCount, state, into);
+}
+
+// Column i if the map has it and the row reaches it, null fields otherwise.
+static CsvField optionalField(const CsvField* fields, int fieldCount, int i) {
+    return i >= 0 && i < fieldCount ? fields[i] : CsvField{nullptr, nullptr};
+}
+
+void TripAnalyzer::useColumns(const TripColumnMap& columns, LineState& state) const {
+    state.columns = columns;
+    state.columnsKnown = true;
+    state.lastRequired = max(columns.tripId, max(columns.pickupZone, columns.pickupTime));
+    state.lastField = max(max(state.lastRequired, columns.dropoffZone), max(columns.distance, columns.fare));
+}
+
+// The layout of headerless rows before one is inferred.
+static const TripColumnMap THREE_COLUMNS;
+
+// Lines with fewer than three fields never count as a header or a data row.
+// The first one that has them decides whether the stream has a header; the
+// layout is settled by the header, a fixed column map or the first valid row
+// it can be inferred from. Until then rows are read as three columns, and
+// rows too short for an inferred layout still are.
+void TripAnalyzer::ingestFields(const CsvField* fields, int fieldCount, LineState& state, Aggregate& into) {
+    if (fieldCount < 3) {
+        TRIP_STATS_INC(into.counters, rejectedNoComma);
+        return;
+    }
+
+    if (!state.headerSkipped) {
+        state.headerSkipped = true;
+        TripColumnMap header;
+        if (readHeader(fields, fieldCount, header)) {
+            useColumns(hasFixedColumns ? fixedColumns : header, state);
+            TRIP_STATS_INC(into.counters, headerLines);
+            return;
+        }
+    }
+    if (!state.columnsKnown) {
+        TripColumnMap inferred;
+        if (hasFixedColumns) useColumns(fixedColumns, state);
+        else if (inferColumns(fields, fieldCount, inferred) && fitsColumns(fields, fieldCount, inferred)) {
+            useColumns(inferred, state);
+            state.inferred = true;
+        }
+    }
+
+    const TripColumnMap& columns = fieldCount > state.lastRequired ? state.columns : THREE_COLUMNS;
+    if (fieldCount <= state.lastRequired && !state.inferred) {
+        TRIP_STATS_INC(into.counters, rejectedNoComma);
+        return;
+    }
+
+    TripFields row;
+    row.id = fields[columns.tripId];
+    row.pickupZone = fields[columns.pickupZone];
+    row.pickupTime = fields[columns.pickupTime];
+    row.dropoffZone = optionalField(fields, fieldCount, columns.dropoffZone);
+    row.distance = optionalField(fields, fieldCount, columns.distance);
+    row.fare = optionalField(fields, fieldCount, columns.fare);
+    ingestRow(row, into);
+}
+
+// Validates one data row and counts it.
+void TripAnalyzer::ingestRow(const TripFields& row, Aggregate& into) {
+    const char* idStart = row.id.begin;
+    const char* idEnd = row.id.end;
+    cleanBounds(idStart, idEnd);
+    if (idStart >= idEnd) {
+        TRIP_STATS_INC(into.counters, rejectedEmptyId);
+        return;
+    }
 
-    zones.clear();
-    zones.reserve(100000);  // Reduced from 200000
-    zones.max_load_factor(1.0f);  // Increased from 0.7f
+    const char* zoneStart = row.pickupZone.begin;
+    const char* zoneEnd = row.pickupZone.end;
+    cleanBounds(zoneStart, zoneEnd);
+    if (zoneStart >= zoneEnd) {
+        TRIP_STATS_INC(into.counters, rejectedEmptyZone);
+        return;
+    }
+
+    int hour;
+    if (!extractHourValue(row.pickupTime.begin, row.pickupTime.end, hour)) {
+        TRIP_STATS_INC(into.counters, rejectedBadHour);
+        return;
+    }
 
-    static const size_t BUFFER_SIZE = 1 << 20;  // Reduced from 1<<22 (4MB to 1MB)
-    static char buffer[BUFFER_SIZE];
+    TRIP_STATS_PHASE(into.counters, INSERT);
+    TRIP_STATS_INC(into.counters, rowsAccepted);
+    size_t zoneLen = (size_t)(zoneEnd - zoneStart);
+    uint64_t zoneHash = hashZoneName(zoneStart, zoneLen);
+    if (into.approx.enabled()) {
+        int slot = hour;
+        if (into.slotMinutes != 60) {
+            const char* time = row.pickupTime.begin;
+            const char* timeEnd = row.pickupTime.end;
+            cleanBounds(time, timeEnd);
+            int minute = parseMinute(time, timeEnd);
+            slot = minute >= 0 ? (hour * 60 + minute) / into.slotMinutes : -1;
+        }
+        into.approx.add(zoneHash, zoneStart, zoneLen, slot);
+        return;
+    }
+    uint32_t pickup = into.zoneId(zoneStart, zoneLen, zoneHash);
+    into.addTrip(pickup, hour);
+    if (into.keepDays || into.slotMinutes != 60) {
+        // extractHourValue checked the length.
+        const char* time = row.pickupTime.begin;
+        const char* timeEnd = row.pickupTime.end;
+        cleanBounds(time, timeEnd);
+        if (into.keepDays) {
+            int day = parseDay(time);
+            if (day >= 0) into.days.add(DayTable::key(pickup, day, hour));
+        }
+        if (into.slotMinutes != 60) {
+            int minute = parseMinute(time, timeEnd);
+            if (minute >= 0) into.slots.add(SlotTable::key(pickup, (hour * 60 + minute) / into.slotMinutes));
+        }
+    }
 
-    string overflow;
-    overflow.reserve(2048);  // Reduced from 4096
+    int32_t value;
+    if (row.fare.begin && parseHundredths(row.fare.begin, row.fare.end, value)) {
+        into.fares.add(pickup, hour, value);
+    }
+    if (row.distance.begin && parseHundredths(row.distance.begin, row.distance.end, value)) {
+        into.distances.add(pickup, hour, value);
+    }
 
-    bool bomProcessed = false;
-    bool headerSkipped = false;
+    const char* dropoffStart = row.dropoffZone.begin;
+    const char* dropoffEnd = row.dropoffZone.end;
+    if (!dropoffStart) return;
+    cleanBounds(dropoffStart, dropoffEnd);
+    if (dropoffStart >= dropoffEnd) return;
+    size_t dropoffLen = (size_t)(dropoffEnd - dropoffStart);
+    into.addRoute(pickup, into.zoneId(dropoffStart, dropoffLen, hashZoneName(dropoffStart, dropoffLen)));
+}
 
+// Column i of an indexed line; i must not exceed the indexed commas.
+static inline CsvField indexedField(const IndexedLine& line, const char* lineEnd, int i) {
+    return CsvField{i == 0 ? line.begin : line.commas[i - 1] + 1, i < line.commaCount ? line.commas[i] : lineEnd};
+}
+
+static inline CsvField optionalIndexedField(const IndexedLine& line, const char* lineEnd, int i) {
+    return i >= 0 && i <= line.commaCount ? indexedField(line, lineEnd, i) : CsvField{nullptr, nullptr};
+}
+
+// Fast path for lines whose commas were already located by the structural
+// scanner, once the header and layout are settled; only the columns in use
+// are located. Quoted lines, lines before that (the BOM, the header, layout
+// inference) and layouts that need columns beyond the indexed commas go
+// through ingestLine. For everything else the comma positions are exactly
+// what splitFields would find, since trimming never removes a comma.
+void TripAnalyzer::ingestIndexedLine(const IndexedLine& line, LineState& state, Aggregate& into) {
+    if (line.hasQuote || !state.bomProcessed || !state.headerSkipped || !state.columnsKnown ||
+        state.lastField >= IndexedLine::MAX_COMMAS) {
+        ingestLine(line.begin, line.end, state, into);
+        return;
+    }
+    TRIP_STATS_PHASE(into.counters, PARSE);
+    TRIP_STATS_INC(into.counters, linesSeen);
+    if (line.commaCount < 2) {
+#if TRIP_ANALYZER_STATS
+        if (isBlankLine(line.begin, line.end)) ++into.counters.rejectedBlank;
+        else ++into.counters.rejectedNoComma;
+#endif
+        return;
+    }
+
+    const char* lineEnd = line.end;
+    if (lineEnd > line.begin && lineEnd[-1] == '\r') --lineEnd;
+
+    bool shortRow = line.commaCount < state.lastRequired;
+    if (shortRow && !state.inferred) {
+        TRIP_STATS_INC(into.counters, rejectedNoComma);
+        return;
+    }
+    const TripColumnMap& columns = shortRow ? THREE_COLUMNS : state.columns;
+    TripFields row;
+    row.id = indexedField(line, lineEnd, columns.tripId);
+    row.pickupZone = indexedField(line, lineEnd, columns.pickupZone);
+    row.pickupTime = indexedField(line, lineEnd, columns.pickupTime);
+    row.dropoffZone = optionalIndexedField(line, lineEnd, columns.dropoffZone);
+    row.distance = optionalIndexedField(line, lineEnd, columns.distance);
+    row.fare = optionalIndexedField(line, lineEnd, columns.fare);
+    ingestRow(row, into);
+}
+
+// Parses every line of [begin, end) in place; the last line does not need a
+// trailing newline.
+void TripAnalyzer::ingestLines(const char* begin, const char* end, LineState& state,
+                               Aggregate& into) {
+    TRIP_STATS_PHASE(into.counters, TOKENIZE);
+    const char* tail = scanLines(begin, end, [&](const IndexedLine& line) {
+        ingestIndexedLine(line, state, into);
+    });
+    if (tail < end) ingestLine(tail, end, state, into);
+}
+
+// Feeds one chunk of a byte stream through the line state machine. Complete
+// lines are parsed in place; a line cut off at the end of the chunk is kept
+// in state.overflow and completed by the next chunk.
+void TripAnalyzer::ingestChunk(const char* data, size_t size, StreamState& state, Aggregate& into) {
+    TRIP_STATS_PHASE(into.counters, TOKENIZE);
+    TRIP_STATS_ADD(into.counters, bytesRead, size);
+    const char* current = data;
+    const char* chunkEnd = data + size;
+
+    if (!state.overflow.empty()) {
+        const char* newline = (const char*)memchr(current, '\n', chunkEnd - current);
+        if (!newline) {
+            state.overflow.append(current, chunkEnd - current);
+            return;
+        }
+        state.overflow.append(current, newline - current);
+        ingestLine(state.overflow.data(), state.overflow.data() + state.overflow.size(), state.line, into);
+        state.overflow.clear();
+        current = newline + 1;
+    }
+
+    const char* tail = scanLines(current, chunkEnd, [&](const IndexedLine& line) {
+        ingestIndexedLine(line, state.line, into);
+    });
+    state.overflow.append(tail, chunkEnd - tail);
+}
+
+// Parses the unterminated last line, if any, and rewinds the state machine so
+// the next chunk is treated as the start of a new stream (BOM, header).
+void TripAnalyzer::finishStream(StreamState& state, Aggregate& into) {
+    if (!state.overflow.empty()) {
+        ingestLine(state.overflow.data(), state.overflow.data() + state.overflow.size(), state.line, into);
+        state.overflow.clear();
+    }
+    state.line = LineState();
+}
+
+void TripAnalyzer::ingestBuffered(FILE* file, char* buffer, size_t bufferSize, StreamState& state,
+                                  Aggregate& into) {
     while (true) {
-        size_t bytesRead = fread(buffer, 1, BUFFER_SIZE, file);
+        size_t bytesRead;
+        {
+            TRIP_STATS_PHASE(into.counters, READ);
+            bytesRead = fread(buffer, 1, bufferSize, file);
+        }
         if (bytesRead == 0) break;
+        ingestChunk(buffer, bytesRead, state, into);
+    }
+    finishStream(state, into);
+}
 
-        const char* current = buffer;
-        const char* bufferEnd = buffer + bytesRead;
+// Maps the file, charging the time to the READ phase.
+static MappedFile mapFile(FILE* file, IngestStats& counters) {
+    TRIP_STATS_PHASE(counters, READ);
+    (void)counters;
+    return MappedFile(fileno(file));
+}
 
-        while (current < bufferEnd) {
-            const char* newline = (const char*)memchr(current, '\n', bufferEnd - current);
-            
-            if (!newline) {
-                overflow.append(current, bufferEnd - current);
-                break;
-            }
+// Parses a whole open file: mapped in place when possible, otherwise read
+// through `buffer`.
+void TripAnalyzer::ingestOpenFile(FILE* file, char* buffer, size_t bufferSize, Aggregate& into) {
+    MappedFile mapped = mapFile(file, into.counters);
+    if (mapped.valid()) {
+        TRIP_STATS_ADD(into.counters, bytesRead, mapped.end() - mapped.begin());
+        LineState state;
+        ingestLines(mapped.begin(), mapped.end(), state, into);
+    } else {
+        StreamState state;
+        ingestBuffered(file, buffer, bufferSize, state, into);
+    }
+}
+
+bool TripAnalyzer::setColumnMap(const TripColumnMap& columns) {
+    for (int column : {columns.tripId, columns.pickupZone, columns.pickupTime}) {
+        if (column < 0 || column >= TripColumnMap::MAX_COLUMNS) return false;
+    }
+    fixedColumns = columns;
+    for (int* column : {&fixedColumns.dropoffZone, &fixedColumns.distance, &fixedColumns.fare}) {
+        if (*column >= TripColumnMap::MAX_COLUMNS) *column = -1;
+    }
+    hasFixedColumns = true;
+    return true;
+}
 
-            const char* lineStart;
-            const char* lineEnd;
-            
-            if (!overflow.empty()) {
-                overflow.append(current, newline - current);
-                lineStart = overflow.data();
-                lineEnd = overflow.data() + overflow.size();
-            } else {
-                lineStart = current;
-                lineEnd = newline;
+void TripAnalyzer::autoDetectColumns() {
+    hasFixedColumns = false;
+}
+
+TripAnalyzer::TripAnalyzer() : working(make_shared<Aggregate>()), published(working) {}
+
+// The published version is immutable, so a copy shares it; only counts the
+// source has not published yet are copied.
+TripAnalyzer::TripAnalyzer(const TripAnalyzer& other)
+    : published(other.snapshot()),
+      modes(other.modes),
+      stream(other.stream),
+      fixedColumns(other.fixedColumns),
+      hasFixedColumns(other.hasFixedColumns),
+      ownBufferSize(other.ownBufferSize) {
+    working = other.working == published ? other.working : make_shared<Aggregate>(*other.working);
+}
+
+TripAnalyzer::TripAnalyzer(TripAnalyzer&& other) : TripAnalyzer() {
+    *this = move(other);
+}
+
+TripAnalyzer& TripAnalyzer::operator=(const TripAnalyzer& other) {
+    if (this != &other) *this = TripAnalyzer(other);
+    return *this;
+}
+
+TripAnalyzer& TripAnalyzer::operator=(TripAnalyzer&& other) {
+    if (this == &other) return *this;
+    working = move(other.working);
+    atomic_store(&published, other.snapshot());
+    stream = move(other.stream);
+    fixedColumns = other.fixedColumns;
+    hasFixedColumns = other.hasFixedColumns;
+    ownBuffer = move(other.ownBuffer);
+    ownBufferSize = other.ownBufferSize;
+    lentBuffer = other.lentBuffer;
+    lentBufferSize = other.lentBufferSize;
+    modes = other.modes;
+
+    other.modes = IngestModes();
+    other.working = make_shared<Aggregate>();
+    atomic_store(&other.published, shared_ptr<const Aggregate>(other.working));
+    other.stream = StreamState();
+    other.hasFixedColumns = false;
+    other.ownBuffer = vector<char>();
+    other.ownBufferSize = DEFAULT_READ_BUFFER;
+    other.useReadBuffer(nullptr, 0);
+    return *this;
+}
+
+TripAnalyzer::Aggregate& TripAnalyzer::writable() {
+    if (working == published) {
+        working = make_shared<Aggregate>(*working);
+        applyModes(*working);
+    }
+    return *working;
+}
+
+// An empty aggregate with the current modes, and no partial line.
+TripAnalyzer::Aggregate& TripAnalyzer::startOver() {
+    auto fresh = make_shared<Aggregate>();
+    fresh->clear();
+    fresh->sameModes(*working);
+    applyModes(*fresh);
+    working = move(fresh);
+    stream = StreamState();
+    return *working;
+}
+
+void TripAnalyzer::setReadBufferSize(size_t bytes) {
+    ownBufferSize = bytes < MIN_READ_BUFFER ? MIN_READ_BUFFER : bytes;
+    if (ownBuffer.size() != ownBufferSize) ownBuffer = vector<char>();
+}
+
+void TripAnalyzer::useReadBuffer(char* buffer, size_t size) {
+    lentBuffer = buffer && size ? buffer : nullptr;
+    lentBufferSize = lentBuffer ? size : 0;
+}
+
+char* TripAnalyzer::readBuffer(size_t& size) {
+    if (lentBuffer) {
+        size = lentBufferSize;
+        return lentBuffer;
+    }
+    if (ownBuffer.size() != ownBufferSize) ownBuffer.resize(ownBufferSize);
+    size = ownBuffer.size();
+    return ownBuffer.data();
+}
+
+// Publishing modes that were configured since the last write takes the
+// copy that write would have made.
+void TripAnalyzer::publish() {
+    if (!hasModes(*working)) writable();
+    atomic_store(&published, shared_ptr<const Aggregate>(working));
+}
+
+void TripAnalyzer::applyModes(Aggregate& zones) const {
+    zones.keepDays = modes.keepDays;
+    if (zones.slotMinutes != modes.slotMinutes) {
+        zones.slots = SlotTable();
+        zones.approx.clearSlots();
+        zones.slotMinutes = modes.slotMinutes;
+    }
+    if (zones.leaders.capacity() != modes.leaders) zones.trackLeaders(modes.leaders);
+}
+
+// The setters below change a private version in place; a published one
+// takes the modes when writable() copies it.
+void TripAnalyzer::trackTopZones(int k) {
+    modes.leaders = k > 0 ? (size_t)k : 0;
+    if (working != published) applyModes(*working);
+}
+
+void TripAnalyzer::trackDays(bool enabled) {
+    modes.keepDays = enabled;
+    if (working != published) applyModes(*working);
+}
+
+bool TripAnalyzer::setSlotMinutes(int minutes) {
+    if (minutes <= 0 || minutes > 60 || 60 % minutes != 0) return false;
+    modes.slotMinutes = minutes;
+    if (working != published) applyModes(*working);
+    return true;
+}
+
+int TripAnalyzer::slotMinutes() const {
+    return snapshot()->slotMinutes;
+}
+
+bool TripAnalyzer::setApproximate(const ApproximateOptions& options) {
+    HeavyHitters::Shape shape;
+    // Half each for the published version and the one being built.
+    if (options.memoryBytes > 0 &&
+        !HeavyHitters::fit(options.memoryBytes / 2, options.epsilon, options.delta, options.candidates, shape)) {
+        return false;
+    }
+    startOver().approx.configure(shape);
+    publish();
+    return true;
+}
+
+ApproximateBounds TripAnalyzer::approximateBounds() const {
+    auto view = snapshot();
+    const HeavyHitters& approx = view->approx;
+    ApproximateBounds bounds;
+    if (!approx.enabled()) return bounds;
+    bounds.approximate = true;
+    bounds.trips = (long long)approx.trips();
+    bounds.epsilon = approx.epsilon();
+    bounds.delta = approx.delta();
+    bounds.sketchError = (long long)(bounds.epsilon * (double)approx.trips());
+    bounds.summaryError = (long long)(approx.trips() / approx.shape().candidates);
+    bounds.memoryBytes = 2 * approx.bytes();
+    return bounds;
+}
+
+void TripAnalyzer::reset() {
+    startOver();
+    publish();
+}
+
+void TripAnalyzer::ingestBuffer(const char* data, size_t size) {
+    ingestChunk(data, size, stream, writable());
+}
+
+void TripAnalyzer::finish() {
+    Aggregate& zones = writable();
+    finishStream(stream, zones);
+    zones.compactDays();
+    publish();
+}
+
+void TripAnalyzer::ingestStream(FILE* input) {
+    if (!input) return;
+    Aggregate& zones = writable();
+    finishStream(stream, zones);
+    size_t bufferSize;
+    char* buffer = readBuffer(bufferSize);
+    ingestBuffered(input, buffer, bufferSize, stream, zones);
+    zones.compactDays();
+    publish();
+}
+
+void TripAnalyzer::ingestFile(const string& csvPath) {
+    if (ingestPath(csvPath)) publish();
+}
+
+// ingestFile that reports whether the file could be opened and leaves
+// publishing to the caller. The counts are only replaced when it could.
+bool TripAnalyzer::ingestPath(const string& csvPath, bool keepRows) {
+    FILE* file = fopen(csvPath.c_str(), "rb");
+    if (!file) return false;
+
+    Aggregate& zones = startOver();
+    zones.keepRows = keepRows;
+    size_t bufferSize;
+    char* buffer = readBuffer(bufferSize);
+    ingestOpenFile(file, buffer, bufferSize, zones);
+    fclose(file);
+    zones.compactDays();
+    return true;
+}
+
+void TripAnalyzer::ingestFiles(const vector<string>& csvPaths, unsigned threads) {
+    size_t fileCount = csvPaths.size();
+    if (fileCount == 0) return;
+
+    if (threads == 0) threads = thread::hardware_concurrency();
+    if (threads == 0) threads = 1;
+    if (threads > fileCount) threads = (unsigned)fileCount;
+    Aggregate& zones = writable();
+
+    // Approximate counting takes the whole budget for one set of sketches,
+    // so the files are read one after another into that set rather than
+    // into sketches of their own.
+    if (zones.approx.enabled()) {
+        size_t bufferSize;
+        char* buffer = readBuffer(bufferSize);
+        for (const string& path : csvPaths) {
+            if (FILE* file = fopen(path.c_str(), "rb")) {
+                ingestOpenFile(file, buffer, bufferSize, zones);
+                fclose(file);
             }
+        }
+        publish();
+        return;
+    }
+
+    // Each file is parsed into its own aggregate. The calling thread folds
+    // them into `zones` strictly in list order, each one as soon as it and
+    // all files before it are done, so the result (including the order in
+    // which zone IDs are assigned) does not depend on thread scheduling.
+    vector<Aggregate> parsed(fileCount);
+    for (Aggregate& a : parsed) a.sameModes(zones);
+    vector<char> ready(fileCount, 0);
+    mutex readyMutex;
+    condition_variable readyChanged;
+    atomic<size_t> nextFile(0);
 
-            if (lineEnd > lineStart && lineEnd[-1] == '\r') --lineEnd;
-            
-            if (lineEnd > lineStart) {
-                const char* start = lineStart;
-                const char* end = lineEnd;
-                
-                while (start < end && isWhitespace(*start)) ++start;
-                if (start < end) {
-                    if (!bomProcessed) {
-                        skipBOM(start, end);
-                        bomProcessed = true;
-                    }
-                    while (start < end && isWhitespace(*start)) ++start;
-                    
-                    if (start < end) {
-                        const char *f0s, *f0e, *f1s, *f1e, *f2s, *f2e;
-                        
-                        if (parseThreeFields(start, end, f0s, f0e, f1s, f1e, f2s, f2e)) {
-                            const char* idStart = f0s;
-                            const char* idEnd = f0e;
-                            cleanBounds(idStart, idEnd);
-                            
-                            if (idStart < idEnd) {
-                                if (!headerSkipped) {
-                                    headerSkipped = true;
-                                    if ((idEnd - idStart) == 6 && memcmp(idStart, "TripID", 6) == 0) {
-                                        overflow.clear();
-                                        current = newline + 1;
-                                        continue;
-                                    }
-                                }
-                                
-                                const char* zoneStart = f1s;
-                                const char* zoneEnd = f1e;
-                                cleanBounds(zoneStart, zoneEnd);
-                                
-                                if (zoneStart < zoneEnd) {
-                                    int hour;
-                                    if (extractHourValue(f2s, f2e, hour)) {
-                                        string zoneName(zoneStart, zoneEnd - zoneStart);
-                                        auto it = zones.find(zoneName);
-                                        if (it == zones.end()) {
-                                            zones[zoneName] = ZoneStats();
-                                            it = zones.find(zoneName);
-                                        }
-                                        ++it->second.total;
-                                        ++it->second.byHour[hour];
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
+    auto worker = [&]() {
+        vector<char> buffer(ownBufferSize);
+        for (size_t i = nextFile++; i < fileCount; i = nextFile++) {
+            if (FILE* file = fopen(csvPaths[i].c_str(), "rb")) {
+                ingestOpenFile(file, buffer.data(), buffer.size(), parsed[i]);
+                fclose(file);
             }
-            
-            overflow.clear();
-            current = newline + 1;
+            {
+                lock_guard<mutex> lock(readyMutex);
+                ready[i] = 1;
+            }
+            readyChanged.notify_one();
         }
+    };
+
+    vector<thread> workers;
+    workers.reserve(threads);
+    for (unsigned t = 0; t < threads; ++t) workers.emplace_back(worker);
+
+    for (size_t i = 0; i < fileCount; ++i) {
+        {
+            unique_lock<mutex> lock(readyMutex);
+            readyChanged.wait(lock, [&]() { return ready[i] != 0; });
+        }
+        zones.merge(parsed[i]);
+        parsed[i] = Aggregate();
+    }
+    for (auto& w : workers) w.join();
+    zones.compactDays();
+    publish();
+}
+
+// Each worker gets at least this many bytes; smaller inputs are not worth a thread.
+static const size_t MIN_PARALLEL_CHUNK = 64 * 1024;
+
+void TripAnalyzer::ingestFileParallel(const string& csvPath, unsigned threads) {
+    FILE* file = fopen(csvPath.c_str(), "rb");
+    if (!file) return;
+
+    Aggregate& zones = startOver();
+
+    MappedFile mapped = mapFile(file, zones.counters);
+    if (!mapped.valid()) {
+        size_t bufferSize;
+        char* buffer = readBuffer(bufferSize);
+        StreamState state;
+        ingestBuffered(file, buffer, bufferSize, state, zones);
+        fclose(file);
+        zones.compactDays();
+        publish();
+        return;
     }
+    TRIP_STATS_ADD(zones.counters, bytesRead, mapped.end() - mapped.begin());
+
+    LineState state;
+
+    // The BOM, the header and the column layout are decided by the first
+    // rows of the file, so consume lines serially until those decisions are
+    // made. Every range after this point then starts from the same state the
+    // serial loop would have.
+    const char* current = mapped.begin();
+    const char* end = mapped.end();
+    while (current < end && !(state.headerSkipped && state.columnsKnown)) {
+        const char* newline = (const char*)memchr(current, '\n', end - current);
+        const char* lineEnd = newline ? newline : end;
+        ingestLine(current, lineEnd, state, zones);
+        current = newline ? newline + 1 : end;
+    }
+
+    if (threads == 0) threads = thread::hardware_concurrency();
+    if (zones.approx.enabled()) threads = 1;  // one set of sketches, see ingestFiles
+    size_t remaining = (size_t)(end - current);
+    size_t maxWorkers = remaining / MIN_PARALLEL_CHUNK;
+    if (maxWorkers < threads) threads = (unsigned)maxWorkers;
+
+    if (threads <= 1) {
+        ingestLines(current, end, state, zones);
+        fclose(file);
+        zones.compactDays();
+        publish();
+        return;
+    }
+
+    // Split at the first newline after each nominal cut so every range holds
+    // whole lines only.
+    vector<const char*> cuts;
+    cuts.push_back(current);
+    for (unsigned i = 1; i < threads; ++i) {
+        const char* cut = current + remaining / threads * i;
+        if (cut < cuts.back()) cut = cuts.back();
+        const char* newline = (const char*)memchr(cut, '\n', end - cut);
+        cuts.push_back(newline ? newline + 1 : end);
+    }
+    cuts.push_back(end);
+
+    vector<Aggregate> shards(threads);
+    for (Aggregate& a : shards) a.sameModes(zones);
+    vector<thread> workers;
+    workers.reserve(threads - 1);
+    for (unsigned i = 1; i < threads; ++i) {
+        workers.emplace_back([this, &cuts, &shards, state, i]() mutable {
+            ingestLines(cuts[i], cuts[i + 1], state, shards[i]);
+        });
+    }
+    ingestLines(cuts[0], cuts[1], state, zones);
+    for (auto& worker : workers) worker.join();
+
+    // Merge in range order so the result never depends on thread timing.
+    for (unsigned i = 1; i < threads; ++i) zones.merge(shards[i]);
 
     fclose(file);
+    zones.compactDays();
+    publish();
 }
 
+// Candidates are ranked by ID and count; names are read from the dictionary
+// arena only to break count ties and copied into strings only for the rows
+// that are returned.
+namespace {
+struct ZoneCandidate {
+    uint32_t id;
+    long long count;
+};
+
+struct SlotCandidate {
+    uint32_t id;
+    int hour;
+    long long count;
+};
+
+struct RouteCandidate {
+    uint64_t key;
+    long long count;
+};
+
+struct DayCellCandidate {
+    uint64_t key;
+    long long count;
+};
+
+struct MinuteSlotCandidate {
+    uint64_t key;
+    long long count;
+};
+
+struct RevenueCandidate {
+    uint32_t id;
+    long long revenue;  // hundredths
+};
+
+// The first k entries of a cached ranking into `out`, if it has them.
+template <typename Ranking, typename T>
+bool cachedPrefix(const shared_ptr<const Ranking>& cache, int k, vector<T>& out) {
+    shared_ptr<const Ranking> ranking = atomic_load(&cache);
+    if (!ranking || !(ranking->all || ranking->best.size() >= (size_t)k)) return false;
+    out.assign(ranking->best.begin(), ranking->best.begin() + std::min(ranking->best.size(), (size_t)k));
+    return true;
+}
+
+// Caches `best` unless the cache already holds as much. Every ranking of
+// one version is a prefix of the whole one, so the longer of two racing
+// queries wins.
+template <typename Ranking, typename T>
+void cacheRanking(shared_ptr<const Ranking>& cache, const vector<T>& best, bool all) {
+    auto next = make_shared<const Ranking>(Ranking{best, all});
+    shared_ptr<const Ranking> current = atomic_load(&cache);
+    while (!current || (!current->all && (all || current->best.size() < best.size()))) {
+        if (atomic_compare_exchange_weak(&cache, &current, next)) return;
+    }
+}
+}  // namespace
+
 vector<ZoneCount> TripAnalyzer::topZones(int k) const {
-    vector<ZoneCount> results;
-    results.reserve(k);
-
-    for (const auto& entry : zones) {
-        ZoneCount candidate{entry.first, entry.second.total};
-        
-        if ((int)results.size() < k) {
-            results.push_back(candidate);
-        } else {
-            bool shouldInsert = false;
-            if (candidate.count > results[k-1].count) shouldInsert = true;
-            else if (candidate.count == results[k-1].count && candidate.zone < results[k-1].zone) shouldInsert = true;
-            
-            if (shouldInsert) results[k-1] = candidate;
-        }
-        
-        
-        for (int i = results.size() - 1; i > 0; --i) {
-            bool needSwap = false;
-            if (results[i].count > results[i-1].count) needSwap = true;
-            else if (results[i].count == results[i-1].count && results[i].zone < results[i-1].zone) needSwap = true;
-            
-            if (needSwap) swap(results[i], results[i-1]);
-            else break;
+    auto view = snapshot();
+    const Aggregate& zones = *view;
+    if (k <= 0) return {};
+
+    RankingCache& cache = zones.rankings;
+    vector<ZoneCount> cached;
+    if (cachedPrefix(cache.zones, k, cached)) return cached;
+
+    if (zones.approx.enabled()) {
+        vector<ZoneCount> ranking = topApproximateZones(zones);
+        cacheRanking(cache.zones, ranking, true);
+        if (ranking.size() > (size_t)k) ranking.resize(k);
+        return ranking;
+    }
+
+    const ZoneDictionary& names = zones.names;
+    size_t tracked = zones.leaders.capacity();
+    if ((size_t)k <= tracked) {
+        vector<ZoneCount> ranking;
+        for (const auto& e : zones.leaders.sorted(zones.leaderOrder())) {
+            ranking.push_back(ZoneCount{string(names.name(e.id)), (long long)e.count});
         }
+        cacheRanking(cache.zones, ranking, ranking.size() < tracked);
+        if (ranking.size() > (size_t)k) ranking.resize(k);
+        return ranking;
     }
 
+    auto better = [&names](const ZoneCandidate& a, const ZoneCandidate& b) {
+        if (a.count != b.count) return a.count > b.count;
+        return names.name(a.id) < names.name(b.id);
+    };
+
+    // Zones seen only as a dropoff have no pickups and are not ranked.
+    size_t zoneCount = zones.stats.size();
+    auto selector = makeTopKSelector<ZoneCandidate>((size_t)k, zoneCount, better);
+    for (uint32_t id = 0; id < (uint32_t)zoneCount; ++id) {
+        uint64_t total = zones.total(id);
+        if (total > 0) selector.push(ZoneCandidate{id, (long long)total});
+    }
+
+    vector<ZoneCount> results;
+    for (const auto& r : selector.take()) results.push_back(ZoneCount{string(names.name(r.id)), r.count});
+
+    cacheRanking(cache.zones, results, results.size() < (size_t)k);
     return results;
 }
 
 vector<SlotCount> TripAnalyzer::topBusySlots(int k) const {
-    vector<SlotCount> results;
-    results.reserve(k);
+    auto view = snapshot();
+    const Aggregate& zones = *view;
+    if (k <= 0) return {};
 
-    for (const auto& entry : zones) {
-        const string& zoneName = entry.first;
-        const ZoneStats& stats = entry.second;
+    RankingCache& cache = zones.rankings;
+    vector<SlotCount> cached;
+    if (cachedPrefix(cache.slots, k, cached)) return cached;
+    if (zones.approx.enabled()) {
+        vector<SlotCount> ranking = topApproximateSlots(zones);
+        cacheRanking(cache.slots, ranking, true);
+        if (ranking.size() > (size_t)k) ranking.resize(k);
+        return ranking;
+    }
+    vector<SlotCount> results = zones.slotMinutes != 60 ? topMinuteSlots(zones, k) : topHourSlots(zones, k);
+
+    cacheRanking(cache.slots, results, results.size() < (size_t)k);
+    return results;
+}
+
+// topBusySlots for hour slots.
+vector<SlotCount> TripAnalyzer::topHourSlots(const Aggregate& zones, int k) const {
+
+    const ZoneDictionary& names = zones.names;
+    auto better = [&names](const SlotCandidate& a, const SlotCandidate& b) {
+        if (a.count != b.count) return a.count > b.count;
+        if (a.id != b.id) return names.name(a.id) < names.name(b.id);
+        return a.hour < b.hour;
+    };
 
+    size_t slotCount = 0;
+    for (const ZoneStats& stats : zones.stats) {
+        for (int h = 0; h < 24; ++h) slotCount += stats.byHour[h] > 0;
+    }
+    slotCount += zones.hourCarries.size() * 24;
+
+    auto selector = makeTopKSelector<SlotCandidate>((size_t)k, slotCount, better);
+    for (uint32_t id = 0; id < (uint32_t)zones.stats.size(); ++id) {
+        const ZoneStats& stats = zones.stats[id];
+        const uint64_t* carries = zones.carriesOf(id);
         for (int h = 0; h < 24; ++h) {
-            long long count = stats.byHour[h];
-            if (count <= 0) continue;
-
-            SlotCount candidate{zoneName, h, count};
-            
-            if ((int)results.size() < k) {
-                results.push_back(candidate);
-            } else {
-                bool shouldInsert = false;
-                if (candidate.count > results[k-1].count) shouldInsert = true;
-                else if (candidate.count == results[k-1].count) {
-                    if (candidate.zone < results[k-1].zone) shouldInsert = true;
-                    else if (candidate.zone == results[k-1].zone && candidate.hour < results[k-1].hour) shouldInsert = true;
-                }
-                
-                if (shouldInsert) results[k-1] = candidate;
-            }
-            
-           
-            for (int i = results.size() - 1; i > 0; --i) {
-                bool needSwap = false;
-                if (results[i].count > results[i-1].count) needSwap = true;
-                else if (results[i].count == results[i-1].count) {
-                    if (results[i].zone < results[i-1].zone) needSwap = true;
-                    else if (results[i].zone == results[i-1].zone && results[i].hour < results[i-1].hour) needSwap = true;
-                }
-                
-                if (needSwap) swap(results[i], results[i-1]);
-                else break;
-            }
+            long long count = (long long)(stats.byHour[h] + (carries ? carries[h] << 32 : 0));
+            if (count > 0) selector.push(SlotCandidate{id, h, count});
+        }
+    }
+
+    vector<SlotCount> results;
+    for (const auto& r : selector.take()) {
+        results.push_back(SlotCount{string(names.name(r.id)), r.hour, r.count});
+    }
+    return results;
+}
+
+// Approximate mode: every candidate by estimated count, ties by zone (and
+// slot) as in the exact rankings.
+vector<ZoneCount> TripAnalyzer::topApproximateZones(const Aggregate& zones) const {
+    vector<HeavyHitters::Estimate> ranked = zones.approx.zones();
+    sort(ranked.begin(), ranked.end(), [](const HeavyHitters::Estimate& a, const HeavyHitters::Estimate& b) {
+        if (a.count != b.count) return a.count > b.count;
+        return a.name < b.name;
+    });
+    vector<ZoneCount> results;
+    for (const auto& e : ranked) {
+        results.push_back(ZoneCount{string(e.name), (long long)e.count, (long long)e.maxError});
+    }
+    return results;
+}
+
+vector<SlotCount> TripAnalyzer::topApproximateSlots(const Aggregate& zones) const {
+    vector<HeavyHitters::Estimate> ranked = zones.approx.slots();
+    sort(ranked.begin(), ranked.end(), [](const HeavyHitters::Estimate& a, const HeavyHitters::Estimate& b) {
+        if (a.count != b.count) return a.count > b.count;
+        if (a.name != b.name) return a.name < b.name;
+        return a.entry->slot < b.entry->slot;
+    });
+    vector<SlotCount> results;
+    for (const auto& e : ranked) {
+        int start = zones.slotMinutes == 60 ? e.entry->slot * 60 : e.entry->slot * zones.slotMinutes;
+        results.push_back(
+            SlotCount{string(e.name), start / 60, (long long)e.count, start % 60, (long long)e.maxError});
+    }
+    return results;
+}
+
+// topBusySlots for slots shorter than an hour. The slot number orders the
+// slots of a zone by start time.
+vector<SlotCount> TripAnalyzer::topMinuteSlots(const Aggregate& zones, int k) const {
+    const ZoneDictionary& names = zones.names;
+    auto better = [&names](const MinuteSlotCandidate& a, const MinuteSlotCandidate& b) {
+        if (a.count != b.count) return a.count > b.count;
+        uint32_t zoneA = SlotTable::zoneOf(a.key), zoneB = SlotTable::zoneOf(b.key);
+        if (zoneA != zoneB) return names.name(zoneA) < names.name(zoneB);
+        return a.key < b.key;
+    };
+
+    auto selector = makeTopKSelector<MinuteSlotCandidate>((size_t)k, zones.slots.size(), better);
+    zones.slots.forEach([&](uint64_t key, long long count) { selector.push(MinuteSlotCandidate{key, count}); });
+
+    vector<SlotCount> results;
+    for (const auto& r : selector.take()) {
+        int start = SlotTable::slotOf(r.key) * zones.slotMinutes;
+        results.push_back(SlotCount{string(names.name(SlotTable::zoneOf(r.key))), start / 60, r.count, start % 60});
+    }
+    return results;
+}
+
+// "YYYY-MM-DD" of a day number, the inverse of parseDay.
+static string formatDay(int day) {
+    int z = day + 719468;
+    int era = z / 146097;
+    int dayOfEra = z - era * 146097;
+    int yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    int dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    int shifted = (5 * dayOfYear + 2) / 153;
+    int month = shifted < 10 ? shifted + 3 : shifted - 9;
+    int year = yearOfEra + era * 400 + (month <= 2);
+    int dayOfMonth = dayOfYear - (153 * shifted + 2) / 5 + 1;
+    char text[32];
+    snprintf(text, sizeof(text), "%04d-%02d-%02d", year, month, dayOfMonth);
+    return text;
+}
+
+// The days a DateFilter lets through.
+struct DayWindow {
+    int first = 0;
+    int last = 0xFFFF;
+    unsigned weekdays = DateFilter::EVERY_DAY;
+
+    bool contains(int day) const { return day >= first && day <= last && (weekdays >> weekdayOf(day) & 1); }
+};
+
+// False if a bound is malformed.
+static bool toWindow(const DateFilter& filter, DayWindow& window) {
+    if (!filter.from.empty() && (filter.from.size() != 10 || (window.first = parseDay(filter.from.data())) < 0)) {
+        return false;
+    }
+    if (!filter.to.empty() && (filter.to.size() != 10 || (window.last = parseDay(filter.to.data())) < 0)) return false;
+    window.weekdays = filter.weekdays & DateFilter::EVERY_DAY;
+    return true;
+}
+
+// Calls f(zone, hour, count) for every per-day cell that passes `filter`.
+// Returns false, calling nothing, if a bound is malformed.
+template <typename F>
+static bool forEachDayCell(const DayCube& cube, const DayTable& pending, const DateFilter& filter, F&& f) {
+    DayWindow window;
+    if (!toWindow(filter, window)) return false;
+    auto inWindow = [&](uint64_t key, long long count) {
+        if (window.contains(DayTable::dayOf(key))) f(DayTable::zoneOf(key), DayTable::hourOf(key), count);
+    };
+    cube.forEach(inWindow);
+    pending.forEach(inWindow);
+    return true;
+}
+
+vector<ZoneCount> TripAnalyzer::topZones(const DateFilter& filter, int k) const {
+    auto view = snapshot();
+    const Aggregate& zones = *view;
+    if (k <= 0) return {};
+
+    size_t zoneCount = zones.names.size();
+    vector<long long> totals(zoneCount, 0);
+    bool valid = forEachDayCell(zones.dayCube, zones.days, filter,
+                                [&](uint32_t id, int, long long count) { totals[id] += count; });
+    if (!valid) return {};
+
+    const ZoneDictionary& names = zones.names;
+    auto better = [&names](const ZoneCandidate& a, const ZoneCandidate& b) {
+        if (a.count != b.count) return a.count > b.count;
+        return names.name(a.id) < names.name(b.id);
+    };
+    auto selector = makeTopKSelector<ZoneCandidate>((size_t)k, zoneCount, better);
+    for (uint32_t id = 0; id < (uint32_t)zoneCount; ++id) {
+        if (totals[id] > 0) selector.push(ZoneCandidate{id, totals[id]});
+    }
+
+    vector<ZoneCount> results;
+    for (const auto& r : selector.take()) results.push_back(ZoneCount{string(names.name(r.id)), r.count});
+    return results;
+}
+
+vector<SlotCount> TripAnalyzer::topBusySlots(const DateFilter& filter, int k) const {
+    auto view = snapshot();
+    const Aggregate& zones = *view;
+    if (k <= 0) return {};
+
+    // Cells of different days fold into one (zone, hour) slot. Only slots
+    // the filter touches take room, so a narrow window over many zones
+    // stays cheap.
+    SlotTable slots;
+    bool valid = forEachDayCell(zones.dayCube, zones.days, filter,
+                                [&](uint32_t id, int hour, long long count) { slots.add(SlotTable::key(id, hour), count); });
+    if (!valid) return {};
+
+    const ZoneDictionary& names = zones.names;
+    auto better = [&names](const SlotCandidate& a, const SlotCandidate& b) {
+        if (a.count != b.count) return a.count > b.count;
+        if (a.id != b.id) return names.name(a.id) < names.name(b.id);
+        return a.hour < b.hour;
+    };
+    auto selector = makeTopKSelector<SlotCandidate>((size_t)k, slots.size(), better);
+    slots.forEach([&](uint64_t key, long long count) {
+        selector.push(SlotCandidate{SlotTable::zoneOf(key), SlotTable::slotOf(key), count});
+    });
+
+    vector<SlotCount> results;
+    for (const auto& r : selector.take()) {
+        results.push_back(SlotCount{string(names.name(r.id)), r.hour, r.count});
+    }
+    return results;
+}
+
+vector<DayCount> TripAnalyzer::dailySeries(const string& zone, const DateFilter& filter) const {
+    auto view = snapshot();
+    const Aggregate& zones = *view;
+    DayWindow window;
+    uint32_t id = zones.names.find(zone.data(), zone.size());
+    if (id == ZoneDictionary::NOT_FOUND || !toWindow(filter, window)) return {};
+
+    vector<DayCount> series;
+    int lastDay = -1;
+    zones.dayCube.forEachInZoneWith(zones.days, id, window.first, window.last, [&](uint64_t key, long long count) {
+        int day = DayTable::dayOf(key);
+        if (!window.contains(day)) return;
+        if (day != lastDay) {
+            series.push_back(DayCount{formatDay(day), 0});
+            lastDay = day;
         }
+        series.back().count += count;
+    });
+    return series;
+}
+
+vector<DaySlotCount> TripAnalyzer::topDaySlots(const DateFilter& filter, int k) const {
+    auto view = snapshot();
+    const Aggregate& zones = *view;
+    DayWindow window;
+    if (k <= 0 || !toWindow(filter, window)) return {};
+
+    const ZoneDictionary& names = zones.names;
+    auto better = [&names](const DayCellCandidate& a, const DayCellCandidate& b) {
+        if (a.count != b.count) return a.count > b.count;
+        uint32_t zoneA = DayTable::zoneOf(a.key), zoneB = DayTable::zoneOf(b.key);
+        if (zoneA != zoneB) return names.name(zoneA) < names.name(zoneB);
+        return a.key < b.key;  // day, then hour
+    };
+
+    // A cell may be in the cube and still pending too; they are summed.
+    auto selector = makeTopKSelector<DayCellCandidate>((size_t)k, zones.dayCube.cells() + zones.days.size(), better);
+    zones.dayCube.forEachWith(zones.days, [&](uint64_t key, long long count) {
+        if (window.contains(DayTable::dayOf(key))) selector.push(DayCellCandidate{key, count});
+    });
+
+    vector<DaySlotCount> results;
+    for (const auto& r : selector.take()) {
+        results.push_back(DaySlotCount{string(names.name(DayTable::zoneOf(r.key))), formatDay(DayTable::dayOf(r.key)),
+                                       DayTable::hourOf(r.key), r.count});
     }
+    return results;
+}
+
+vector<RouteCount> TripAnalyzer::topRoutes(int k) const {
+    auto view = snapshot();
+    const Aggregate& zones = *view;
+    if (k <= 0) return {};
+
+    const ZoneDictionary& names = zones.names;
+    auto better = [&names](const RouteCandidate& a, const RouteCandidate& b) {
+        if (a.count != b.count) return a.count > b.count;
+        uint32_t pickupA = RouteTable::pickupOf(a.key), pickupB = RouteTable::pickupOf(b.key);
+        if (pickupA != pickupB) return names.name(pickupA) < names.name(pickupB);
+        return names.name(RouteTable::dropoffOf(a.key)) < names.name(RouteTable::dropoffOf(b.key));
+    };
+
+    auto selector = makeTopKSelector<RouteCandidate>((size_t)k, zones.routes.size(), better);
+    zones.routes.forEach([&](uint64_t key, long long count) { selector.push(RouteCandidate{key, count}); });
+
+    vector<RouteCount> results;
+    for (const auto& r : selector.take()) {
+        results.push_back(RouteCount{string(names.name(RouteTable::pickupOf(r.key))),
+                                     string(names.name(RouteTable::dropoffOf(r.key))), r.count});
+    }
+    return results;
+}
+
+static MetricSummary toSummary(const MetricTable::Summary& s) {
+    MetricSummary out;
+    if (s.count == 0) return out;
+    out.count = s.count;
+    out.sum = s.sum / 100.0;
+    out.min = s.min / 100.0;
+    out.max = s.max / 100.0;
+    out.mean = (double)s.sum / s.count / 100.0;
+    return out;
+}
 
+ZoneMetrics TripAnalyzer::zoneMetrics(const string& zone, int hour) const {
+    auto view = snapshot();
+    const Aggregate& zones = *view;
+    ZoneMetrics result;
+    if (hour > 23) return result;
+    uint32_t id = zones.names.find(zone.data(), zone.size());
+    if (id == ZoneDictionary::NOT_FOUND) return result;
+    result.fare = toSummary(zones.fares.summarize(id, hour));
+    result.distance = toSummary(zones.distances.summarize(id, hour));
+    return result;
+}
+
+vector<ZoneRevenue> TripAnalyzer::topZonesByRevenue(int k) const {
+    auto view = snapshot();
+    const Aggregate& zones = *view;
+    if (k <= 0) return {};
+
+    size_t zoneCount = zones.names.size();
+    vector<long long> revenue, trips;
+    zones.fares.zoneTotals(zoneCount, revenue, trips);
+
+    const ZoneDictionary& names = zones.names;
+    auto better = [&names](const RevenueCandidate& a, const RevenueCandidate& b) {
+        if (a.revenue != b.revenue) return a.revenue > b.revenue;
+        return names.name(a.id) < names.name(b.id);
+    };
+    auto selector = makeTopKSelector<RevenueCandidate>((size_t)k, zoneCount, better);
+    for (uint32_t id = 0; id < (uint32_t)zoneCount; ++id) {
+        if (trips[id] > 0) selector.push(RevenueCandidate{id, revenue[id]});
+    }
+
+    vector<ZoneRevenue> results;
+    for (const auto& r : selector.take()) {
+        results.push_back(ZoneRevenue{string(names.name(r.id)), r.revenue / 100.0, trips[r.id]});
+    }
     return results;
 }
+
+// Nanoseconds per IngestStats::now() tick, measured once against the
+// steady clock.
+static double nanosPerTick() {
+    static const double ratio = []() {
+        using namespace std::chrono;
+        auto t0 = steady_clock::now();
+        uint64_t c0 = IngestStats::now();
+        while (steady_clock::now() - t0 < milliseconds(5)) {}
+        double ns = (double)duration_cast<nanoseconds>(steady_clock::now() - t0).count();
+        uint64_t ticks = IngestStats::now() - c0;
+        return ticks ? ns / ticks : 1.0;
+    }();
+    return ratio;
+}
+
+IngestStats TripAnalyzer::stats() const {
+    auto view = snapshot();
+    const Aggregate& zones = *view;
+    IngestStats result;
+    if (!IngestStats::enabled) return result;
+    result.add(zones.counters);
+    zones.names.addProbeStats(result);
+    result.nanosPerCycle = nanosPerTick();
+    return result;
+}
@@ -1,30 +1,490 @@
 #pragma once
+#include <array>
+#include <cstdio>
+#include <memory>
 #include <string>
-#include <vector>
 #include <unordered_map>
+#include <vector>
+#include "csv_scan.h"
+#include "ingest_stats.h"
+#include "metric_table.h"
+#include "count_table.h"
+#include "day_cube.h"
+#include "heavy_hitters.h"
+#include "topk.h"
+#include "zone_table.h"
 
+// In approximate mode count may be over the true count by up to maxError;
+// otherwise maxError is 0.
 struct ZoneCount {
     std::string zone;
     long long count;
+    long long maxError = 0;
 };
 
+// A (zone, time slot) pair. Slots are hours unless setSlotMinutes chose a
+// finer width; minute is where the slot starts within the hour.
 struct SlotCount {
     std::string zone;
     int hour;
     long long count;
+    int minute = 0;
+    long long maxError = 0;
+};
+
+struct RouteCount {
+    std::string pickupZone;
+    std::string dropoffZone;
+    long long count;
+};
+
+// Count, sum, extremes and mean of one numeric column over the trips that
+// had a valid value in it; all zero when there were none.
+struct MetricSummary {
+    long long count = 0;
+    double sum = 0;
+    double min = 0;
+    double max = 0;
+    double mean = 0;
+};
+
+struct ZoneMetrics {
+    MetricSummary fare;
+    MetricSummary distance;
+};
+
+struct ZoneRevenue {
+    std::string zone;
+    double revenue;   // sum of fares
+    long long trips;  // trips with a valid fare
+};
+
+// Pickups on one calendar day ("YYYY-MM-DD").
+struct DayCount {
+    std::string date;
+    long long count;
+};
+
+// Pickups in one zone in one hour of one calendar day.
+struct DaySlotCount {
+    std::string zone;
+    std::string date;
+    int hour;
+    long long count;
 };
 
+// Calendar restriction for the date-aware queries: pickups on days from
+// `from` to `to` inclusive ("YYYY-MM-DD", empty for no bound) that fall on
+// one of the `weekdays`.
+struct DateFilter {
+    enum : unsigned {
+        MONDAY = 1, TUESDAY = 2, WEDNESDAY = 4, THURSDAY = 8, FRIDAY = 16, SATURDAY = 32, SUNDAY = 64,
+        WEEKDAYS = 31, WEEKEND = 96, EVERY_DAY = 127
+    };
+
+    std::string from;
+    std::string to;
+    unsigned weekdays = EVERY_DAY;
+};
+
+// Approximate mode (see TripAnalyzer::setApproximate). memoryBytes is the
+// budget for the sketches and candidate lists, 0 for exact counting; it
+// covers the published version and the one being built, half each. Zone
+// names are kept up to 32 bytes, longer ones are reported cut there.
+// epsilon bounds the overcount of any reported count as a fraction of all
+// trips (0: as tight as the budget allows), except with probability delta.
+// candidates is how many zones, and how many slots, are tracked.
+struct ApproximateOptions {
+    size_t memoryBytes = 0;
+    double epsilon = 0;
+    double delta = 0.001;
+    size_t candidates = 4096;
+};
+
+// The guarantees behind approximate rankings. Every reported count is at
+// least the true count. It is over by at most its own maxError; by at most
+// sketchError = epsilon * trips except with probability delta; and every
+// zone or slot with more than summaryError trips is in the candidates.
+struct ApproximateBounds {
+    bool approximate = false;  // false: counts are exact, the rest is zero
+    long long trips = 0;
+    double epsilon = 0;
+    double delta = 0;
+    long long sketchError = 0;
+    long long summaryError = 0;
+    size_t memoryBytes = 0;  // allocated for both versions, within the budget
+};
+
+// Zero-based CSV column of each trip field; -1 marks a column that is not
+// present. The defaults are the three-column layout.
+struct TripColumnMap {
+    static const int MAX_COLUMNS = 64;
+
+    int tripId = 0;
+    int pickupZone = 1;
+    int dropoffZone = -1;
+    int pickupTime = 2;
+    int distance = -1;
+    int fare = -1;
+};
+
+// Queries (the const members) read an immutable published version of the
+// aggregates, so any number of threads may run them, also while another
+// thread ingests. Ingestion works on a private version and publishes it
+// when the call returns: a query sees the state before or after a whole
+// ingestFile, ingestFiles, finish() and so on, never a partial one. Until
+// then the previous version stays in memory next to the new one. The two
+// share nothing: the first write after a publish copies the aggregates,
+// O(zones + stored cells), so a live stream is best published per batch of
+// rows rather than per row. Configuration calls (trackDays, setSlotMinutes,
+// trackTopZones) cost O(1) and publish nothing, so they never expose a
+// half-fed stream: they apply to the version being built, or if there is
+// none yet to the next one. The non-const calls must not overlap each
+// other.
 class TripAnalyzer {
 public:
+    // A copy starts out sharing the published version and takes the counts
+    // not yet published, the stream in progress and the settings with it,
+    // except a lent read buffer. Copying reads the source's private version,
+    // so it must not overlap the source's non-const calls. A moved-from
+    // instance is empty, with default settings.
+    TripAnalyzer();
+    TripAnalyzer(const TripAnalyzer& other);
+    TripAnalyzer(TripAnalyzer&& other);
+    TripAnalyzer& operator=(const TripAnalyzer& other);
+    TripAnalyzer& operator=(TripAnalyzer&& other);
+
+    // Column layout of the input. By default every stream decides it from
+    // its first line: a header is matched by column name (TripID,
+    // PickupZoneID, DropoffZoneID, PickupTime, Distance, Fare and common
+    // variants, case-insensitive). Without a header the layout is inferred
+    // from the first row with a timestamp: time in column 2 is the
+    // three-column layout, time in column 3 is the SmallTrips.csv layout (id,
+    // pickup, dropoff, time, distance, fare). setColumnMap fixes the layout
+    // for streams started afterwards instead (a header line is still
+    // skipped); it returns false and changes nothing unless tripId,
+    // pickupZone and pickupTime are valid columns. autoDetectColumns goes
+    // back to the default.
+    bool setColumnMap(const TripColumnMap& columns);
+    void autoDetectColumns();
+
+    // With trackDays(true), trips ingested afterwards are also counted per
+    // (zone, calendar day, hour), which the DateFilter queries read. Cells
+    // are hashed while a file or stream is read and compacted into per-zone
+    // day runs when it ends (see DayCube), so memory follows the cells that
+    // have pickups; it is still off by default. Trips whose date is
+    // malformed or outside 1970-2149 only count in the unfiltered results.
+    // Trip-column files and snapshots keep no dates.
+    void trackDays(bool enabled);
+
+    // Width of the slots topBusySlots ranks: a divisor of 60 (5 and 15 for
+    // surge pricing, 60 for hours, the default). Finer slots read the
+    // minute of PickupTime as well and are counted per (zone, slot) on top
+    // of the hourly counts, which every other query keeps using. Trips
+    // without a valid minute ("HH:MM") only count hourly. Changing the width
+    // drops the slot counts collected so far; they are not kept in
+    // trip-column files or snapshots. Returns false and changes nothing for
+    // any other width. slotMinutes() is the width of the published counts.
+    bool setSlotMinutes(int minutes);
+    int slotMinutes() const;
+
+    // Approximate mode, for feeds with more zones or slots than exact
+    // counting can hold. Pickups then go to a Count-Min sketch and a
+    // Space-Saving candidate list per zone and per slot, within
+    // options.memoryBytes, and topZones / topBusySlots rank the candidates
+    // by estimated count (see ApproximateBounds). Nothing else is counted,
+    // so the other queries see no trips, and saveSnapshot, loadSnapshot,
+    // writeTripColumns and ingestTripColumns, whose files hold exact counts,
+    // return false. ingestFiles and ingestFileParallel read on the calling
+    // thread, into the one set of sketches. As always, the published
+    // version stays in memory while the next one is built, so each gets
+    // half the budget. Switching the mode on, off or to other options
+    // drops all counts. Returns false and changes nothing if the options do
+    // not fit the budget.
+    bool setApproximate(const ApproximateOptions& options);
+    ApproximateBounds approximateBounds() const;
+
+    // Read buffer. Input that cannot be memory-mapped (pipes, ingestStream)
+    // is read in chunks through a buffer of each instance's own, 1 MB
+    // unless setReadBufferSize chose another size (at least 4 KB), allocated
+    // on first use. useReadBuffer lends a caller-owned buffer instead, e.g.
+    // from a pool; it must stay valid while this instance ingests, and
+    // useReadBuffer(nullptr, 0) returns to the own one. ingestFiles workers
+    // always use buffers of their own of the configured size. Instances
+    // share no mutable state, so distinct instances may ingest on different
+    // threads at the same time.
+    void setReadBufferSize(size_t bytes);
+    void useReadBuffer(char* buffer, size_t size);
+
     void ingestFile(const std::string& csvPath);
+    // Same result as ingestFile, but splits the file into newline-aligned
+    // ranges parsed on `threads` workers (0 = hardware concurrency).
+    void ingestFileParallel(const std::string& csvPath, unsigned threads = 0);
+    // Adds every file to the current counts, one file per worker with at
+    // most `threads` workers (0 = hardware concurrency). Files that cannot be
+    // opened are skipped. The result does not depend on thread scheduling.
+    void ingestFiles(const std::vector<std::string>& csvPaths, unsigned threads = 0);
+
+    // Streaming ingestion. Unlike ingestFile these add to the current counts.
+    // ingestBuffer accepts arbitrary slices of CSV text (lines may straddle
+    // calls); its rows become visible to queries on publish() or finish().
+    // finish() parses a trailing line without newline and ends the stream,
+    // so the next ingestBuffer starts a new one (BOM and header are detected
+    // again). ingestStream finishes any pending stream, then reads `input`
+    // to EOF as one complete stream.
+    void ingestBuffer(const char* data, size_t size);
+    void publish();
+    void finish();
+    void ingestStream(FILE* input);
+    // Drops all counts and any partially received line.
+    void reset();
+
+    // Binary columnar trip files. writeTripColumns ingests csvPath like
+    // ingestFile and also writes every accepted trip as a row of a zone-ID
+    // column and an hour column, plus the zone dictionary. ingestTripColumns
+    // replaces the current counts from such a file, read through mmap with no
+    // text parsing. Both return false on I/O errors or a malformed file.
+    bool writeTripColumns(const std::string& csvPath, const std::string& columnsPath);
+    bool ingestTripColumns(const std::string& columnsPath);
+
+    // Aggregate snapshots: just the per-zone totals and hour counts, in a
+    // versioned, checksummed binary file that is far smaller than the input.
+    // loadSnapshot replaces the current counts and returns false (leaving
+    // them untouched) if the file is missing, truncated, corrupt or from an
+    // unknown version.
+    bool saveSnapshot(const std::string& path) const;
+    bool loadSnapshot(const std::string& path);
+
+    // The ranking of a published version is kept up to the largest k asked,
+    // so repeating a query until the next publish() only copies k entries.
     std::vector<ZoneCount> topZones(int k = 10) const;
     std::vector<SlotCount> topBusySlots(int k = 10) const;
+    // With trackTopZones(K), the K best zones are kept current as every
+    // trip is counted, and topZones(k) for k <= K sorts those K instead of
+    // scanning every zone; a larger k still scans. Only the query gets
+    // cheaper: publishing and the first write after it copy the counts as
+    // described above, which grows with the zone count. It takes over the
+    // counts so far; 0, the default, turns it off.
+    void trackTopZones(int k);
+    // The same rankings over the pickups that pass `filter`, from the
+    // per-day counts (empty unless trackDays was on). A malformed bound
+    // gives an empty result.
+    std::vector<ZoneCount> topZones(const DateFilter& filter, int k = 10) const;
+    std::vector<SlotCount> topBusySlots(const DateFilter& filter, int k = 10) const;
+    // Pickups per day in `zone` on the days that pass `filter`, oldest
+    // first. Days without pickups are left out.
+    std::vector<DayCount> dailySeries(const std::string& zone, const DateFilter& filter = DateFilter()) const;
+    // Busiest (zone, day, hour) cells that pass `filter`: count descending,
+    // then zone, date and hour ascending.
+    std::vector<DaySlotCount> topDaySlots(const DateFilter& filter, int k = 10) const;
+    // Busiest pickup -> dropoff pairs: count descending, then pickup zone,
+    // then dropoff zone ascending. Only rows with a non-empty dropoff zone
+    // count, so this is empty for inputs without a dropoff column. Routes
+    // are not kept in trip-column files or snapshots.
+    std::vector<RouteCount> topRoutes(int k = 10) const;
+
+    // Fare and distance of the trips picked up in `zone`, or in (zone, hour)
+    // for hour 0-23. Values come from the Fare and Distance columns as
+    // decimals with up to two fractional digits ("12", "12.5", "-3.75"); a
+    // trip with a missing or malformed value still counts everywhere else.
+    // Unknown zones give all-zero summaries.
+    ZoneMetrics zoneMetrics(const std::string& zone, int hour = -1) const;
+    // Zones by total fare, descending, ties by zone ascending. Zones without
+    // any fare are left out.
+    std::vector<ZoneRevenue> topZonesByRevenue(int k = 10) const;
+
+    // Counters and phase timings for the data currently loaded (they are
+    // cleared with the counts). Phase cycles are summed over worker threads.
+    // All zero unless built with TRIP_ANALYZER_STATS.
+    IngestStats stats() const;
 
 private:
+    // Lets the tests add counts no input file could reach.
+    friend struct TripAnalyzerTestAccess;
+
+    // Pickups of one zone: 32-bit hour counters, 96 bytes instead of 200
+    // for 64-bit counters and a total. The total is their sum. An hour
+    // counter that wraps carries into Aggregate::hourCarries, which is
+    // empty until some counter wraps, so until then no zone needs a lookup.
     struct ZoneStats {
-        long long total;
-        long long byHour[24];
+        uint32_t byHour[24];
         ZoneStats();
     };
-    std::unordered_map<std::string, ZoneStats> zones;
+    // topZones / topBusySlots results of one aggregate, best first, as long
+    // as the largest k asked so far. A published aggregate never changes, so
+    // its rankings stay valid for its lifetime, and a copy (the next version
+    // ingestion builds) starts with an empty cache. Each ranking is itself
+    // immutable and swapped in whole with atomic_compare_exchange, so a
+    // cache hit takes no lock.
+    template <typename T>
+    struct Ranking {
+        std::vector<T> best;
+        bool all;  // `best` is the whole ranking
+    };
+    struct RankingCache {
+        std::shared_ptr<const Ranking<ZoneCount>> zones;
+        std::shared_ptr<const Ranking<SlotCount>> slots;
+        RankingCache() = default;
+        RankingCache(const RankingCache&) {}
+        RankingCache& operator=(const RankingCache&) {
+            zones.reset();
+            slots.reset();
+            return *this;
+        }
+    };
+    // Zone names interned to dense IDs; stats[id] belongs to names.name(id).
+    // Pickup and dropoff zones share the dictionary, so a zone seen only as
+    // a dropoff has an entry with zero pickups.
+    // With keepRows set, every accepted trip is also recorded as a row
+    // (zone ID, hour) in input order, for writeTripColumns. With keepDays
+    // set, trips with a valid date are also counted in `days`, which
+    // compactDays() empties into dayCube once it holds a sixteenth as many
+    // cells as the cube. A rebuild costs every cell of the cube, so growing
+    // it by a fraction at a time keeps the total linear over a stream;
+    // queries read the cube and `days` together. With a leader capacity,
+    // every increase of a zone total also updates `leaders`.
+    struct Aggregate {
+        ZoneDictionary names;
+        std::vector<ZoneStats> stats;
+        // Zone ID -> high 32 bits of each hour's count, for zones with one.
+        std::unordered_map<uint32_t, std::array<uint64_t, 24>> hourCarries;
+        RouteTable routes;
+        DayTable days;
+        DayCube dayCube;
+        MetricTable fares;      // hundredths
+        MetricTable distances;  // hundredths
+        bool keepRows = false;
+        bool keepDays = false;
+        int slotMinutes = 60;
+        // Per (zone, slot) counts when slotMinutes < 60.
+        SlotTable slots;
+        std::vector<uint32_t> rowZones;
+        std::vector<uint8_t> rowHours;
+        IngestStats counters;
+        mutable RankingCache rankings;
+        TopKTracker leaders;  // the best zones by total, topZones order
+        HeavyHitters approx;  // counts everything instead when enabled
+
+        void clear();
+        // Takes over the keep* switches of `owner`, for worker aggregates.
+        void sameModes(const Aggregate& owner) {
+            keepRows = owner.keepRows;
+            keepDays = owner.keepDays;
+            slotMinutes = owner.slotMinutes;
+            approx.configure(owner.approx.shape());
+        }
+        uint32_t zoneId(const char* name, size_t len, uint64_t hash);
+        void addTrip(uint32_t id, int hour);
+        // Adds n pickups to (id, hour), carrying as needed.
+        void addHourCount(uint32_t id, int hour, uint64_t n);
+        long long hourCount(uint32_t id, int hour) const;
+        uint64_t total(uint32_t id) const;
+        // The zone's entry in hourCarries, or null.
+        const uint64_t* carriesOf(uint32_t id) const {
+            if (hourCarries.empty()) return nullptr;
+            auto it = hourCarries.find(id);
+            return it == hourCarries.end() ? nullptr : it->second.data();
+        }
+        // Keeps the k best zones in `leaders` from now on (none for 0).
+        void trackLeaders(size_t k);
+        struct LeaderOrder {
+            const ZoneDictionary* names;
+            bool operator()(const TopKTracker::Entry& a, const TopKTracker::Entry& b) const {
+                if (a.count != b.count) return a.count > b.count;
+                return names->name(a.id) < names->name(b.id);
+            }
+        };
+        LeaderOrder leaderOrder() const { return LeaderOrder{&names}; }
+        void bumpLeader(uint32_t id) {
+            if (leaders.capacity()) leaders.bump(id, total(id), leaderOrder());
+        }
+        void addRoute(uint32_t pickup, uint32_t dropoff) { routes.add(RouteTable::key(pickup, dropoff)); }
+        void compactDays() {
+            if (days.empty() || days.size() * 16 < dayCube.cells()) return;
+            dayCube.absorb(days);
+            days = DayTable();
+        }
+        void merge(const Aggregate& other);
+    };
+    // Ingestion writes to `working`, queries read `published` through
+    // std::atomic_load. The two are one object after a publish until the
+    // next write, which copies it first (writable()); ingestFile and other
+    // calls that replace the counts start from a new one (startOver()).
+    std::shared_ptr<Aggregate> working;
+    std::shared_ptr<const Aggregate> published;
+
+    Aggregate& writable();
+    Aggregate& startOver();
+
+    // The configured modes, which a private version takes on when it is
+    // built (applyModes), so configuring never copies a published one.
+    struct IngestModes {
+        bool keepDays = false;
+        int slotMinutes = 60;
+        size_t leaders = 0;
+    };
+    IngestModes modes;
+    void applyModes(Aggregate& zones) const;
+    bool hasModes(const Aggregate& zones) const {
+        return zones.keepDays == modes.keepDays && zones.slotMinutes == modes.slotMinutes &&
+               zones.leaders.capacity() == modes.leaders;
+    }
+    std::shared_ptr<const Aggregate> snapshot() const { return std::atomic_load(&published); }
+
+    // Parser state carried from one line to the next. Until the layout is
+    // known every line is split in full; afterwards only up to lastField.
+    struct LineState {
+        bool bomProcessed = false;
+        bool headerSkipped = false;
+        bool columnsKnown = false;
+        bool inferred = false;  // columns came from a headerless row
+        TripColumnMap columns;
+        int lastRequired = 2;
+        int lastField = TripColumnMap::MAX_COLUMNS - 1;
+    };
+    // Line state plus the unterminated tail of the last chunk.
+    struct StreamState {
+        LineState line;
+        std::string overflow;
+    };
+    StreamState stream;
+
+    TripColumnMap fixedColumns;
+    bool hasFixedColumns = false;
+
+    static const size_t DEFAULT_READ_BUFFER = 1 << 20;
+    static const size_t MIN_READ_BUFFER = 4 << 10;
+    std::vector<char> ownBuffer;
+    size_t ownBufferSize = DEFAULT_READ_BUFFER;
+    char* lentBuffer = nullptr;
+    size_t lentBufferSize = 0;
+    // The buffer for the serial entry points; sets `size`.
+    char* readBuffer(size_t& size);
+
+    bool ingestPath(const std::string& csvPath, bool keepRows = false);
+    void ingestLine(const char* lineStart, const char* lineEnd, LineState& state, Aggregate& into);
+    void ingestIndexedLine(const IndexedLine& line, LineState& state, Aggregate& into);
+    // The fields of one data row that the aggregates read. Optional
+    // columns the input lacks have null pointers.
+    struct TripFields {
+        CsvField id;
+        CsvField pickupZone;
+        CsvField pickupTime;
+        CsvField dropoffZone;
+        CsvField distance;
+        CsvField fare;
+    };
+
+    void ingestFields(const CsvField* fields, int fieldCount, LineState& state, Aggregate& into);
+    void ingestRow(const TripFields& row, Aggregate& into);
+    void useColumns(const TripColumnMap& columns, LineState& state) const;
+    void ingestLines(const char* begin, const char* end, LineState& state, Aggregate& into);
+    void ingestChunk(const char* data, size_t size, StreamState& state, Aggregate& into);
+    void finishStream(StreamState& state, Aggregate& into);
+    void ingestBuffered(FILE* file, char* buffer, size_t bufferSize, StreamState& state, Aggregate& into);
+    void ingestOpenFile(FILE* file, char* buffer, size_t bufferSize, Aggregate& into);
+    std::vector<ZoneCount> topApproximateZones(const Aggregate& zones) const;
+    std::vector<SlotCount> topApproximateSlots(const Aggregate& zones) const;
+    std::vector<SlotCount> topHourSlots(const Aggregate& zones, int k) const;
+    std::vector<SlotCount> topMinuteSlots(const Aggregate& zones, int k) const;
 };
@@ -0,0 +1,361 @@
+#include "analyzer.h"
+#include "mapped_file.h"
+#include <array>
+#include <cstring>
+#include <cstdio>
+
+using namespace std;
+
+// Binary trip-column file layout (native byte order, every section 64-byte
+// aligned so columns can be used straight from the mapping):
+//
+//   ColumnsHeader
+//   ColumnEntry[columnCount]   directory: kind, element size, offset, bytes
+//   column data ...
+//
+// Readers look columns up by kind and ignore kinds they do not know, so new
+// columns can be added without breaking older files.
+
+namespace {
+
+const char COLUMNS_MAGIC[8] = {'T', 'R', 'I', 'P', 'C', 'O', 'L', 'S'};
+const uint32_t COLUMNS_VERSION = 1;
+const size_t SECTION_ALIGN = 64;
+
+enum ColumnKind : uint32_t {
+    COLUMN_ZONE_NAME_OFFSETS = 1,  // uint64 x (zoneCount + 1)
+    COLUMN_ZONE_NAME_CHARS = 2,    // char x offsets[zoneCount]
+    COLUMN_TRIP_ZONE = 3,          // uint32 zone ID x rowCount
+    COLUMN_TRIP_HOUR = 4,          // uint8 hour x rowCount
+};
+
+struct ColumnsHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t columnCount;
+    uint64_t rowCount;
+    uint64_t zoneCount;
+};
+
+struct ColumnEntry {
+    uint32_t kind;
+    uint32_t elementSize;
+    uint64_t offset;
+    uint64_t bytes;
+};
+
+struct ColumnSource {
+    uint32_t kind;
+    uint32_t elementSize;
+    const void* data;
+    uint64_t bytes;
+};
+
+size_t alignUp(size_t n) {
+    return (n + SECTION_ALIGN - 1) / SECTION_ALIGN * SECTION_ALIGN;
+}
+
+bool writePadding(FILE* out, size_t from, size_t to) {
+    static const char zeros[SECTION_ALIGN] = {};
+    return to == from || fwrite(zeros, 1, to - from, out) == to - from;
+}
+
+// Whole-file contents: mapped when possible, read into memory otherwise.
+class FileBytes {
+public:
+    explicit FileBytes(FILE* file) : mapped(fileno(file)) {
+        if (mapped.valid()) return;
+        char chunk[1 << 16];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) copy.insert(copy.end(), chunk, chunk + n);
+    }
+
+    const char* data() const { return mapped.valid() ? mapped.begin() : copy.data(); }
+    size_t size() const { return mapped.valid() ? (size_t)(mapped.end() - mapped.begin()) : copy.size(); }
+
+private:
+    MappedFile mapped;
+    vector<char> copy;
+};
+
+// Looks up a column and checks that it lies inside the file with the
+// expected element size; returns nullptr otherwise.
+const char* findColumn(const char* base, size_t fileSize, const ColumnEntry* dir, uint32_t columnCount,
+                       uint32_t kind, uint32_t elementSize, uint64_t& bytesOut) {
+    for (uint32_t i = 0; i < columnCount; ++i) {
+        const ColumnEntry& c = dir[i];
+        if (c.kind != kind) continue;
+        if (c.elementSize != elementSize) return nullptr;
+        if (c.offset > fileSize || c.bytes > fileSize - c.offset) return nullptr;
+        if (c.offset % SECTION_ALIGN != 0) return nullptr;
+        bytesOut = c.bytes;
+        return base + c.offset;
+    }
+    return nullptr;
+}
+
+}  // namespace
+
+bool TripAnalyzer::writeTripColumns(const string& csvPath, const string& columnsPath) {
+    if (working->approx.enabled()) return false;  // rows are not kept
+    if (!ingestPath(csvPath, true)) return false;
+    Aggregate& zones = *working;
+    zones.keepRows = false;
+
+    size_t zoneCount = zones.names.size();
+    vector<uint64_t> nameOffsets;
+    string nameChars;
+    nameOffsets.reserve(zoneCount + 1);
+    nameOffsets.push_back(0);
+    for (uint32_t id = 0; id < (uint32_t)zoneCount; ++id) {
+        string_view name = zones.names.name(id);
+        nameChars.append(name.data(), name.size());
+        nameOffsets.push_back(nameChars.size());
+    }
+
+    const ColumnSource columns[] = {
+        {COLUMN_ZONE_NAME_OFFSETS, 8, nameOffsets.data(), nameOffsets.size() * 8},
+        {COLUMN_ZONE_NAME_CHARS, 1, nameChars.data(), nameChars.size()},
+        {COLUMN_TRIP_ZONE, 4, zones.rowZones.data(), zones.rowZones.size() * 4},
+        {COLUMN_TRIP_HOUR, 1, zones.rowHours.data(), zones.rowHours.size()},
+    };
+    const uint32_t columnCount = sizeof(columns) / sizeof(columns[0]);
+
+    ColumnsHeader header;
+    memcpy(header.magic, COLUMNS_MAGIC, sizeof(header.magic));
+    header.version = COLUMNS_VERSION;
+    header.columnCount = columnCount;
+    header.rowCount = zones.rowZones.size();
+    header.zoneCount = zoneCount;
+
+    ColumnEntry dir[columnCount];
+    size_t offset = alignUp(sizeof(header) + sizeof(dir));
+    for (uint32_t i = 0; i < columnCount; ++i) {
+        dir[i] = ColumnEntry{columns[i].kind, columns[i].elementSize, offset, columns[i].bytes};
+        offset = alignUp(offset + columns[i].bytes);
+    }
+
+    FILE* out = fopen(columnsPath.c_str(), "wb");
+    bool ok = out != nullptr;
+    if (ok) {
+        size_t at = sizeof(header) + sizeof(dir);
+        ok = fwrite(&header, sizeof(header), 1, out) == 1 && fwrite(dir, sizeof(dir), 1, out) == 1;
+        for (uint32_t i = 0; ok && i < columnCount; ++i) {
+            ok = writePadding(out, at, dir[i].offset) &&
+                 (columns[i].bytes == 0 || fwrite(columns[i].data, 1, columns[i].bytes, out) == columns[i].bytes);
+            at = dir[i].offset + columns[i].bytes;
+        }
+        ok = writePadding(out, at, alignUp(at)) && ok;
+        ok = fclose(out) == 0 && ok;
+    }
+
+    zones.rowZones = vector<uint32_t>();
+    zones.rowHours = vector<uint8_t>();
+    publish();
+    return ok;
+}
+
+bool TripAnalyzer::ingestTripColumns(const string& columnsPath) {
+    if (working->approx.enabled()) return false;
+    FILE* file = fopen(columnsPath.c_str(), "rb");
+    if (!file) return false;
+    FileBytes bytes(file);
+    fclose(file);
+
+    const char* base = bytes.data();
+    size_t size = bytes.size();
+    if (size < sizeof(ColumnsHeader)) return false;
+
+    ColumnsHeader header;
+    memcpy(&header, base, sizeof(header));
+    if (memcmp(header.magic, COLUMNS_MAGIC, sizeof(header.magic)) != 0 || header.version != COLUMNS_VERSION) {
+        return false;
+    }
+    if (header.columnCount > (size - sizeof(header)) / sizeof(ColumnEntry)) return false;
+    const ColumnEntry* dir = (const ColumnEntry*)(base + sizeof(header));
+
+    uint64_t offsetBytes = 0, charBytes = 0, zoneBytes = 0, hourBytes = 0;
+    const uint64_t* nameOffsets = (const uint64_t*)findColumn(base, size, dir, header.columnCount,
+                                                              COLUMN_ZONE_NAME_OFFSETS, 8, offsetBytes);
+    const char* nameChars = findColumn(base, size, dir, header.columnCount, COLUMN_ZONE_NAME_CHARS, 1, charBytes);
+    const uint32_t* tripZones = (const uint32_t*)findColumn(base, size, dir, header.columnCount,
+                                                            COLUMN_TRIP_ZONE, 4, zoneBytes);
+    const uint8_t* tripHours = (const uint8_t*)findColumn(base, size, dir, header.columnCount,
+                                                          COLUMN_TRIP_HOUR, 1, hourBytes);
+    if (!nameOffsets || !nameChars || !tripZones || !tripHours) return false;
+    // Counts from the header are bounded by the column sizes before any
+    // arithmetic on them, so a crafted count cannot wrap past the checks.
+    if (offsetBytes < 8 || offsetBytes % 8 != 0 || header.zoneCount != offsetBytes / 8 - 1 ||
+        zoneBytes % 4 != 0 || header.rowCount != zoneBytes / 4 || hourBytes != header.rowCount) {
+        return false;
+    }
+    for (uint64_t i = 0; i < header.zoneCount; ++i) {
+        if (nameOffsets[i] > nameOffsets[i + 1]) return false;
+    }
+    if (nameOffsets[0] != 0 || nameOffsets[header.zoneCount] > charBytes) return false;
+
+    Aggregate& zones = startOver();
+
+    // A well-formed file maps ID i to i; the remap only matters for files
+    // whose dictionary repeats a name.
+    vector<uint32_t> remap(header.zoneCount);
+    for (uint64_t i = 0; i < header.zoneCount; ++i) {
+        const char* name = nameChars + nameOffsets[i];
+        size_t len = (size_t)(nameOffsets[i + 1] - nameOffsets[i]);
+        remap[i] = zones.zoneId(name, len, hashZoneName(name, len));
+    }
+
+    for (uint64_t row = 0; row < header.rowCount; ++row) {
+        uint32_t zone = tripZones[row];
+        uint8_t hour = tripHours[row];
+        if (zone >= header.zoneCount || hour >= 24) continue;
+        zones.addTrip(remap[zone], hour);
+    }
+    publish();
+    return true;
+}
+
+// Aggregate snapshot layout (native byte order):
+//
+//   SnapshotHeader
+//   uint64 nameOffsets[zoneCount + 1]
+//   int64  counts[zoneCount][25]     total, then hours 0..23
+//   char   names[nameBytes]
+//
+// The checksum is a CRC-32C (Castagnoli) of everything after the header, in
+// the low 32 bits of its field. It is there to catch damaged files: it
+// detects every error burst of up to 32 bits and misses other damage with
+// probability 2^-32, but it is no defence against deliberate tampering.
+// Counts are always 64-bit, whatever the in-memory counter width; a zone's
+// total is stored for readers, and loading rebuilds it from the hours.
+
+namespace {
+
+const char SNAPSHOT_MAGIC[8] = {'T', 'R', 'I', 'P', 'A', 'G', 'G', 'R'};
+const uint32_t SNAPSHOT_VERSION = 2;  // 1 used the zone-name hash as checksum
+const size_t COUNTS_PER_ZONE = 25;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t zoneCount;
+    uint64_t nameBytes;
+    uint64_t payloadBytes;
+    uint64_t checksum;
+};
+
+// CRC-32C, reflected, one table lookup per byte. Snapshots hold a few
+// hundred bytes per zone, so this is far from the cost of writing them.
+uint64_t payloadChecksum(const char* data, size_t size) {
+    static const auto table = [] {
+        array<uint32_t, 256> t{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int bit = 0; bit < 8; ++bit) c = c & 1 ? (c >> 1) ^ 0x82F63B78u : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+    uint32_t crc = ~0u;
+    for (size_t i = 0; i < size; ++i) crc = table[(crc ^ (uint8_t)data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+}  // namespace
+
+bool TripAnalyzer::saveSnapshot(const string& path) const {
+    auto view = snapshot();
+    const Aggregate& zones = *view;
+    if (zones.approx.enabled()) return false;  // no exact counts to save
+    size_t zoneCount = zones.names.size();
+
+    vector<char> payload;
+    size_t offsetsBytes = (zoneCount + 1) * sizeof(uint64_t);
+    size_t countsBytes = zoneCount * COUNTS_PER_ZONE * sizeof(int64_t);
+    payload.resize(offsetsBytes + countsBytes);
+
+    uint64_t* nameOffsets = (uint64_t*)payload.data();
+    int64_t* counts = (int64_t*)(payload.data() + offsetsBytes);
+    nameOffsets[0] = 0;
+    for (uint32_t id = 0; id < (uint32_t)zoneCount; ++id) {
+        nameOffsets[id + 1] = nameOffsets[id] + zones.names.name(id).size();
+        int64_t* row = counts + (size_t)id * COUNTS_PER_ZONE;
+        row[0] = (int64_t)zones.total(id);
+        for (int h = 0; h < 24; ++h) row[1 + h] = zones.hourCount(id, h);
+    }
+    size_t nameBytes = (size_t)nameOffsets[zoneCount];
+    for (uint32_t id = 0; id < (uint32_t)zoneCount; ++id) {
+        string_view name = zones.names.name(id);
+        payload.insert(payload.end(), name.begin(), name.end());
+    }
+
+    SnapshotHeader header;
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.reserved = 0;
+    header.zoneCount = zoneCount;
+    header.nameBytes = nameBytes;
+    header.payloadBytes = payload.size();
+    header.checksum = payloadChecksum(payload.data(), payload.size());
+
+    FILE* out = fopen(path.c_str(), "wb");
+    if (!out) return false;
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+              fwrite(payload.data(), 1, payload.size(), out) == payload.size();
+    ok = fclose(out) == 0 && ok;
+    return ok;
+}
+
+bool TripAnalyzer::loadSnapshot(const string& path) {
+    if (working->approx.enabled()) return false;
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) return false;
+    FileBytes bytes(file);
+    fclose(file);
+
+    if (bytes.size() < sizeof(SnapshotHeader)) return false;
+    SnapshotHeader header;
+    memcpy(&header, bytes.data(), sizeof(header));
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 || header.version != SNAPSHOT_VERSION) {
+        return false;
+    }
+
+    const char* payload = bytes.data() + sizeof(header);
+    size_t payloadBytes = bytes.size() - sizeof(header);
+    if (header.payloadBytes != payloadBytes) return false;
+
+    // Per zone: one name offset and 25 counts, all 8 bytes wide.
+    const uint64_t perZone = (1 + COUNTS_PER_ZONE) * 8;
+    if (header.zoneCount > payloadBytes / perZone) return false;
+    size_t offsetsBytes = (size_t)(header.zoneCount + 1) * sizeof(uint64_t);
+    size_t countsBytes = (size_t)header.zoneCount * COUNTS_PER_ZONE * sizeof(int64_t);
+    if (offsetsBytes + countsBytes > payloadBytes ||
+        header.nameBytes != payloadBytes - offsetsBytes - countsBytes) {
+        return false;
+    }
+    if (payloadChecksum(payload, payloadBytes) != header.checksum) return false;
+
+    vector<uint64_t> nameOffsets(header.zoneCount + 1);
+    memcpy(nameOffsets.data(), payload, offsetsBytes);
+    for (uint64_t i = 0; i < header.zoneCount; ++i) {
+        if (nameOffsets[i] > nameOffsets[i + 1]) return false;
+    }
+    if (nameOffsets[0] != 0 || nameOffsets[header.zoneCount] != header.nameBytes) return false;
+
+    const char* counts = payload + offsetsBytes;
+    const char* names = counts + countsBytes;
+
+    Aggregate& zones = startOver();
+    for (uint64_t i = 0; i < header.zoneCount; ++i) {
+        const char* name = names + nameOffsets[i];
+        size_t len = (size_t)(nameOffsets[i + 1] - nameOffsets[i]);
+        uint32_t id = zones.zoneId(name, len, hashZoneName(name, len));
+
+        int64_t row[COUNTS_PER_ZONE];
+        memcpy(row, counts + i * COUNTS_PER_ZONE * sizeof(int64_t), sizeof(row));
+        for (int h = 0; h < 24; ++h) zones.addHourCount(id, h, (uint64_t)row[1 + h]);
+    }
+    publish();
+    return true;
+}
@@ -0,0 +1,227 @@
+// Ingest and ranking benchmark over synthetic trip files.
+//
+//   make bench                                   # 1M and 10M rows, every dataset
+//   ./benchmark --rows 1M,10M,100M --runs 7 --datasets zipf,unique
+//
+// Each dataset is generated once per size into a temporary file, then
+// ingested --runs times. Reported per phase: median and p95 wall time, plus
+// rows/s and MB/s for ingestion and the peak RSS seen while the dataset was
+// processed.
+#include "analyzer.h"
+#include "trip_gen.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+// ---------------- datasets ----------------
+struct Dataset {
+    const char* name;
+    const char* description;
+};
+
+const Dataset DATASETS[] = {
+    {"uniform", "1k zones, uniform zones and hours"},
+    {"zipf", "100k zones, Zipf(1.1) zone popularity"},
+    {"unique", "every row a new zone"},
+    {"onehot", "a single zone"},
+    {"dirty", "half the rows malformed"},
+    {"quoted", "every field quoted, CRLF line ends"},
+};
+
+// Writes `rows` trip rows of the given dataset to path; returns bytes written
+// (0 on failure).
+uint64_t generate(const std::string& dataset, uint64_t rows, const std::string& path) {
+    FILE* out = fopen(path.c_str(), "wb");
+    if (!out) return 0;
+
+    TripGenOptions options;
+    options.rows = rows;
+    options.seed = 0x5EED0000 + rows;
+    options.days = 28;
+    if (dataset == "zipf") { options.zones = 100000; options.zipf = 1.1; }
+    if (dataset == "unique") { options.zones = rows; options.sequentialZones = true; }
+    if (dataset == "onehot") options.zones = 1;
+    if (dataset == "dirty") options.badRatio = 0.5;
+    if (dataset == "quoted") { options.quoteRatio = 1; options.crlf = true; }
+
+    uint64_t written = writeTrips(options, out);
+    return fclose(out) == 0 ? written : 0;
+}
+
+// ---------------- measurement ----------------
+double nowMs() {
+    using namespace std::chrono;
+    return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Peak resident set size in MB. On Linux the high-water mark is reset per
+// dataset through /proc/self/clear_refs; elsewhere it is the process peak.
+void resetPeakRss() {
+    if (FILE* f = fopen("/proc/self/clear_refs", "w")) {
+        fputs("5", f);
+        fclose(f);
+    }
+}
+
+double peakRssMb() {
+    if (FILE* f = fopen("/proc/self/status", "r")) {
+        char line[256];
+        long kb = -1;
+        while (fgets(line, sizeof(line), f)) {
+            if (strncmp(line, "VmHWM:", 6) == 0) kb = atol(line + 6);
+        }
+        fclose(f);
+        if (kb >= 0) return kb / 1024.0;
+    }
+#if defined(__unix__) || defined(__APPLE__)
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+    return usage.ru_maxrss / 1024.0;
+#endif
+#else
+    return 0;
+#endif
+}
+
+struct Summary {
+    double median;
+    double p95;
+};
+
+Summary summarize(std::vector<double> samples) {
+    std::sort(samples.begin(), samples.end());
+    size_t n = samples.size();
+    double median = n % 2 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+    size_t rank = (size_t)std::ceil(0.95 * n);
+    return Summary{median, samples[rank ? rank - 1 : 0]};
+}
+
+uint64_t parseRows(const std::string& s) {
+    char* end = nullptr;
+    double v = strtod(s.c_str(), &end);
+    if (end && (*end == 'k' || *end == 'K')) v *= 1e3;
+    if (end && (*end == 'm' || *end == 'M')) v *= 1e6;
+    return (uint64_t)v;
+}
+
+std::vector<std::string> splitList(const std::string& s) {
+    std::vector<std::string> out;
+    size_t start = 0;
+    while (start <= s.size()) {
+        size_t comma = s.find(',', start);
+        if (comma == std::string::npos) comma = s.size();
+        if (comma > start) out.push_back(s.substr(start, comma - start));
+        start = comma + 1;
+    }
+    return out;
+}
+
+void usage() {
+    fprintf(stderr,
+            "usage: benchmark [--rows 1M,10M] [--runs N] [--datasets a,b] [--dir DIR] [--keep]\n"
+            "datasets:\n");
+    for (const Dataset& d : DATASETS) fprintf(stderr, "  %-8s %s\n", d.name, d.description);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    std::vector<std::string> sizes = {"1M", "10M"};
+    std::vector<std::string> datasets;
+    for (const Dataset& d : DATASETS) datasets.push_back(d.name);
+    int runs = 5;
+    std::string dir = "/tmp";
+    bool keep = false;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--rows" && hasValue) sizes = splitList(argv[++i]);
+        else if (arg == "--runs" && hasValue) runs = std::max(1, atoi(argv[++i]));
+        else if (arg == "--datasets" && hasValue) datasets = splitList(argv[++i]);
+        else if (arg == "--dir" && hasValue) dir = argv[++i];
+        else if (arg == "--keep") keep = true;
+        else { usage(); return 2; }
+    }
+    for (const std::string& dataset : datasets) {
+        bool known = false;
+        for (const Dataset& d : DATASETS) known = known || dataset == d.name;
+        if (!known || sizes.empty()) { usage(); return 2; }
+    }
+
+    printf("%-8s %6s | %-11s %10s %10s | %10s %9s | %9s\n", "dataset", "rows", "phase",
+           "median ms", "p95 ms", "Mrows/s", "MB/s", "peak MB");
+
+    for (const std::string& dataset : datasets) {
+        for (const std::string& size : sizes) {
+            uint64_t rows = parseRows(size);
+            std::string path = dir + "/trip_bench_" + dataset + "_" + size + ".csv";
+
+            uint64_t bytes = generate(dataset, rows, path);
+            if (bytes == 0) {
+                fprintf(stderr, "could not write %s\n", path.c_str());
+                return 1;
+            }
+
+            resetPeakRss();
+            std::vector<double> ingestMs, topZonesMs, topZonesLargeMs, topSlotsMs, topSlotsLargeMs;
+            for (int r = 0; r < runs; ++r) {
+                TripAnalyzer analyzer;
+                double t0 = nowMs();
+                analyzer.ingestFile(path);
+                double t1 = nowMs();
+                analyzer.topZones(10);
+                double t2 = nowMs();
+                analyzer.topZones(10000);
+                double t3 = nowMs();
+                analyzer.topBusySlots(10);
+                double t4 = nowMs();
+                analyzer.topBusySlots(50000);
+                double t5 = nowMs();
+                ingestMs.push_back(t1 - t0);
+                topZonesMs.push_back(t2 - t1);
+                topZonesLargeMs.push_back(t3 - t2);
+                topSlotsMs.push_back(t4 - t3);
+                topSlotsLargeMs.push_back(t5 - t4);
+            }
+            double peak = peakRssMb();
+
+            auto report = [&](const char* phase, const std::vector<double>& samples, bool throughput) {
+                Summary s = summarize(samples);
+                printf("%-8s %6s | %-11s %10.2f %10.2f | ", dataset.c_str(), size.c_str(), phase, s.median,
+                       s.p95);
+                if (throughput && s.median > 0) {
+                    printf("%10.2f %9.1f", rows / s.median / 1e3, bytes / s.median / 1e3);
+                } else {
+                    printf("%10s %9s", "", "");
+                }
+                printf(" | %9.1f\n", peak);
+            };
+            report("ingestFile", ingestMs, true);
+            report("topZones10", topZonesMs, false);
+            report("topZones10k", topZonesLargeMs, false);
+            report("topSlots10", topSlotsMs, false);
+            report("topSlots50k", topSlotsLargeMs, false);
+            fflush(stdout);
+
+            if (!keep) remove(path.c_str());
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,98 @@
+// Microbenchmark: ZoneDictionary + per-ID stats vector against the
+// std::unordered_map<std::string, ...> lookup pattern ingestFile used before
+// (find, then operator[] + find on miss).
+//
+//   make microbench && ./microbench
+#include "zone_table.h"
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct Stats {
+    long long total = 0;
+    long long byHour[24] = {};
+};
+
+static std::string zpad(int n, int width) {
+    std::string s = std::to_string(n);
+    if ((int)s.size() >= width) return s;
+    return std::string(width - (int)s.size(), '0') + s;
+}
+
+// Key stream as the parser would see it: each key is a slice of one buffer.
+struct Workload {
+    const char* name;
+    std::string text;
+    std::vector<std::pair<size_t, size_t>> keys;
+};
+
+static Workload makeWorkload(const char* name, int uniqueZones, int rows) {
+    Workload w{name, {}, {}};
+    w.text.reserve((size_t)rows * 8);
+    w.keys.reserve(rows);
+    for (int i = 0; i < rows; i++) {
+        size_t at = w.text.size();
+        // A prime stride visits every zone, in scattered order.
+        w.text += "Z" + zpad((int)((unsigned long long)i * 2654435761ull % (unsigned)uniqueZones), 6);
+        w.keys.push_back({at, w.text.size() - at});
+    }
+    return w;
+}
+
+template <typename Fn>
+static double timeMs(Fn fn) {
+    auto t0 = std::chrono::steady_clock::now();
+    fn();
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(t1 - t0).count();
+}
+
+static void run(const Workload& w) {
+    long long checkA = 0, checkB = 0;
+
+    double mapMs = timeMs([&] {
+        std::unordered_map<std::string, Stats> zones;
+        zones.reserve(100000);
+        zones.max_load_factor(1.0f);
+        for (size_t i = 0; i < w.keys.size(); i++) {
+            std::string zoneName(w.text.data() + w.keys[i].first, w.keys[i].second);
+            auto it = zones.find(zoneName);
+            if (it == zones.end()) {
+                zones[zoneName] = Stats();
+                it = zones.find(zoneName);
+            }
+            ++it->second.total;
+            ++it->second.byHour[i % 24];
+        }
+        checkA = (long long)zones.size();
+    });
+
+    double tableMs = timeMs([&] {
+        ZoneDictionary names;
+        std::vector<Stats> stats;
+        names.reserve(100000);
+        for (size_t i = 0; i < w.keys.size(); i++) {
+            uint32_t id = names.intern(w.text.data() + w.keys[i].first, w.keys[i].second);
+            if (id == stats.size()) stats.emplace_back();
+            ++stats[id].total;
+            ++stats[id].byHour[i % 24];
+        }
+        checkB = (long long)names.size();
+    });
+
+    double rows = (double)w.keys.size();
+    printf("%-34s rows=%-9zu zones=%-8lld unordered_map %8.1f ms (%6.1f ns/row)   "
+           "dictionary %8.1f ms (%6.1f ns/row)   speedup %.2fx%s\n",
+           w.name, w.keys.size(), checkB, mapMs, mapMs * 1e6 / rows, tableMs, tableMs * 1e6 / rows,
+           mapMs / tableMs, checkA == checkB ? "" : "   MISMATCH");
+}
+
+int main() {
+    run(makeWorkload("C1: every row a new zone", 500000, 500000));
+    run(makeWorkload("unique zones, 10 rows each", 300000, 3000000));
+    run(makeWorkload("C2: few zones, many rows", 4, 5000000));
+    run(makeWorkload("1k zones, many rows", 1000, 5000000));
+    return 0;
+}
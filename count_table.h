@@ -0,0 +1,108 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Counts per 64-bit key, for aggregates keyed by packed dictionary IDs
+// (RouteTable, DayTable) rather than by names.
+//
+// Each slot holds the key next to its count (16 bytes, four per cache line):
+// with many distinct keys the table outgrows the caches, and an insert then
+// costs a single miss. Open addressing with linear probing, load factor at
+// most one half. Keys must not be ~0.
+class CountTable {
+public:
+    CountTable() { clear(); }
+
+    size_t size() const { return used; }
+    bool empty() const { return used == 0; }
+
+    void clear() {
+        slots.assign(16, Slot{EMPTY, 0});
+        shift = 60;
+        used = 0;
+    }
+
+    void add(uint64_t k, long long n = 1) {
+        size_t pos = probeFor(k);
+        if (slots[pos].key == EMPTY) {
+            if ((used + 1) * 2 > slots.size()) {
+                grow();
+                pos = probeFor(k);
+            }
+            slots[pos].key = k;
+            ++used;
+        }
+        slots[pos].count += n;
+    }
+
+    // Calls f(key, count) for every key, in table order.
+    template <typename F>
+    void forEach(F&& f) const {
+        for (const Slot& slot : slots) {
+            if (slot.key != EMPTY) f(slot.key, slot.count);
+        }
+    }
+
+private:
+    static constexpr uint64_t EMPTY = ~0ull;
+
+    struct Slot {
+        uint64_t key;
+        long long count;
+    };
+
+    std::vector<Slot> slots;
+    int shift;  // 64 - log2(capacity)
+    size_t used;
+
+    size_t slotOf(uint64_t k) const { return (size_t)((k * 0x9E3779B97F4A7C15ull) >> shift); }
+
+    size_t probeFor(uint64_t k) const {
+        size_t mask = slots.size() - 1;
+        size_t pos = slotOf(k);
+        while (slots[pos].key != EMPTY && slots[pos].key != k) pos = (pos + 1) & mask;
+        return pos;
+    }
+
+    void grow() {
+        std::vector<Slot> old;
+        old.swap(slots);
+        slots.assign(old.size() * 2, Slot{EMPTY, 0});
+        --shift;
+        size_t mask = slots.size() - 1;
+        for (const Slot& slot : old) {
+            if (slot.key == EMPTY) continue;
+            size_t pos = slotOf(slot.key);
+            while (slots[pos].key != EMPTY) pos = (pos + 1) & mask;
+            slots[pos] = slot;
+        }
+    }
+};
+
+// Trip counts per (pickup, dropoff) zone pair. No zone ID reaches
+// 0xFFFFFFFF (ZoneDictionary::NOT_FOUND), so no key is ~0.
+class RouteTable : public CountTable {
+public:
+    static uint64_t key(uint32_t pickup, uint32_t dropoff) { return (uint64_t)pickup << 32 | dropoff; }
+    static uint32_t pickupOf(uint64_t key) { return (uint32_t)(key >> 32); }
+    static uint32_t dropoffOf(uint64_t key) { return (uint32_t)key; }
+};
+
+// Pickup counts per (zone, calendar day, hour). Days are numbered from
+// 1970-01-01 and fit 16 bits.
+class DayTable : public CountTable {
+public:
+    static uint64_t key(uint32_t zone, int day, int hour) { return (uint64_t)zone << 32 | (uint32_t)day << 8 | (uint32_t)hour; }
+    static uint32_t zoneOf(uint64_t key) { return (uint32_t)(key >> 32); }
+    static int dayOf(uint64_t key) { return (int)(key >> 8 & 0xFFFF); }
+    static int hourOf(uint64_t key) { return (int)(key & 0xFF); }
+};
+
+// Pickup counts per (zone, slot of the day), for slots shorter than an hour.
+class SlotTable : public CountTable {
+public:
+    static uint64_t key(uint32_t zone, int slot) { return (uint64_t)zone << 32 | (uint32_t)slot; }
+    static uint32_t zoneOf(uint64_t key) { return (uint32_t)(key >> 32); }
+    static int slotOf(uint64_t key) { return (int)(uint32_t)key; }
+};
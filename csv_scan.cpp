@@ -0,0 +1,84 @@
+#include "csv_scan.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define CSV_SCAN_X86 1
+#include <immintrin.h>
+#else
+#define CSV_SCAN_X86 0
+#endif
+
+static void scanBlockScalar(const char* block, StructuralMasks& masks) {
+    uint64_t newline = 0, comma = 0, quote = 0;
+    for (int i = 0; i < 64; ++i) {
+        char c = block[i];
+        newline |= (uint64_t)(c == '\n') << i;
+        comma |= (uint64_t)(c == ',') << i;
+        quote |= (uint64_t)(c == '"') << i;
+    }
+    masks.newline = newline;
+    masks.comma = comma;
+    masks.quote = quote;
+}
+
+#if CSV_SCAN_X86
+__attribute__((target("sse2")))
+static void scanBlockSse2(const char* block, StructuralMasks& masks) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i cm = _mm_set1_epi8(',');
+    const __m128i qt = _mm_set1_epi8('"');
+    uint64_t newline = 0, comma = 0, quote = 0;
+    for (int i = 0; i < 4; ++i) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(block + 16 * i));
+        newline |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)) << (16 * i);
+        comma |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, cm)) << (16 * i);
+        quote |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, qt)) << (16 * i);
+    }
+    masks.newline = newline;
+    masks.comma = comma;
+    masks.quote = quote;
+}
+
+__attribute__((target("avx2")))
+static void scanBlockAvx2(const char* block, StructuralMasks& masks) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    const __m256i cm = _mm256_set1_epi8(',');
+    const __m256i qt = _mm256_set1_epi8('"');
+    __m256i lo = _mm256_loadu_si256((const __m256i*)block);
+    __m256i hi = _mm256_loadu_si256((const __m256i*)(block + 32));
+    masks.newline = (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, nl)) |
+                    (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, nl)) << 32;
+    masks.comma = (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, cm)) |
+                  (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, cm)) << 32;
+    masks.quote = (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, qt)) |
+                  (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, qt)) << 32;
+}
+#endif
+
+namespace {
+struct ScannerChoice {
+    BlockScanFn fn;
+    const char* name;
+};
+
+ScannerChoice chooseScanner() {
+#if CSV_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return {scanBlockAvx2, "avx2"};
+    if (__builtin_cpu_supports("sse2")) return {scanBlockSse2, "sse2"};
+#endif
+    return {scanBlockScalar, "scalar"};
+}
+
+const ScannerChoice& scannerChoice() {
+    static const ScannerChoice choice = chooseScanner();
+    return choice;
+}
+}  // namespace
+
+BlockScanFn structuralScanner() {
+    return scannerChoice().fn;
+}
+
+const char* structuralScannerName() {
+    return scannerChoice().name;
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Structural-character indexing for the CSV tokenizer.
+//
+// Instead of one memchr pass per delimiter, each 64-byte block is classified
+// once: bit i of a mask is set when block[i] is a newline, comma or quote.
+// scanLines walks those bits in order and hands every line to the caller
+// together with the positions of its first commas.
+
+struct StructuralMasks {
+    uint64_t newline;
+    uint64_t comma;
+    uint64_t quote;
+};
+
+using BlockScanFn = void (*)(const char* block, StructuralMasks& masks);
+
+// Block scanner for the running CPU: AVX2, SSE2 or portable scalar code,
+// chosen once on first use.
+BlockScanFn structuralScanner();
+const char* structuralScannerName();
+
+// One newline-terminated line and the positions of its first commas.
+struct IndexedLine {
+    static const int MAX_COMMAS = 16;
+
+    const char* begin;
+    const char* end;   // the '\n'
+    bool hasQuote;
+    int commaCount;    // all commas of the line; only MAX_COMMAS are stored
+    const char* commas[MAX_COMMAS];
+};
+
+// One field of a split line, quotes and padding not yet removed.
+struct CsvField {
+    const char* begin;
+    const char* end;
+};
+
+inline int lowestBit(uint64_t bits) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(bits);
+#else
+    int i = 0;
+    while (!(bits & 1)) { bits >>= 1; ++i; }
+    return i;
+#endif
+}
+
+// Calls onLine(const IndexedLine&) for every newline-terminated line of
+// [begin, end) and returns the start of the unterminated tail (end if the
+// range ends with a newline).
+template <typename OnLine>
+const char* scanLines(const char* begin, const char* end, OnLine&& onLine) {
+    BlockScanFn scan = structuralScanner();
+
+    IndexedLine line;
+    line.begin = begin;
+    line.hasQuote = false;
+    line.commaCount = 0;
+
+    for (const char* block = begin; block < end; block += 64) {
+        StructuralMasks m;
+        size_t avail = (size_t)(end - block);
+        if (avail >= 64) {
+            scan(block, m);
+        } else {
+            char padded[64] = {};
+            memcpy(padded, block, avail);
+            scan(padded, m);
+        }
+
+        uint64_t bits = m.newline | m.comma | m.quote;
+        while (bits) {
+            int i = lowestBit(bits);
+            uint64_t bit = bits & (0 - bits);
+            bits ^= bit;
+
+            const char* p = block + i;
+            if (m.newline & bit) {
+                line.end = p;
+                onLine(line);
+                line.begin = p + 1;
+                line.hasQuote = false;
+                line.commaCount = 0;
+            } else if (m.comma & bit) {
+                if (line.commaCount < IndexedLine::MAX_COMMAS) line.commas[line.commaCount] = p;
+                ++line.commaCount;
+            } else {
+                line.hasQuote = true;
+            }
+        }
+    }
+    return line.begin;
+}
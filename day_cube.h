@@ -0,0 +1,139 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "count_table.h"
+
+// Pickup counts per (zone, calendar day, hour), compacted for reading.
+//
+// Ingestion collects cells in a DayTable, which costs 32 bytes per cell (a
+// 16-byte slot at load factor one half). absorb() moves them here: each
+// zone is a run of its days in ascending order, a day being its number, a
+// mask of the hours with pickups and the position of its first count, and
+// the counts of a day follow in hour order. A cell then costs 4 bytes plus
+// 10 per (zone, day) and 16 per zone, so memory follows the non-empty cells
+// rather than zones x days x 24, and a zone's days in a window are found by
+// binary search.
+class DayCube {
+public:
+    bool empty() const { return counts.empty(); }
+    size_t cells() const { return counts.size(); }
+    // Zone IDs below this have days.
+    uint32_t zones() const { return zoneRuns.empty() ? 0 : (uint32_t)(zoneRuns.size() - 1); }
+
+    void clear() { *this = DayCube(); }
+
+    // Adds the cells of `pending`, summing those already present.
+    void absorb(const DayTable& pending) {
+        DayCube merged;
+        forEachWith(pending, [&](uint64_t key, long long count) { merged.append(key, count); });
+        merged.seal();
+        *this = std::move(merged);
+    }
+
+    // Calls f(key, count) with a DayTable key for every cell, by zone, day
+    // and hour.
+    template <typename F>
+    void forEach(F&& f) const {
+        for (uint32_t zone = 0; zone < zones(); ++zone) forEachInZone(zone, 0, 0xFFFF, f);
+    }
+
+    // The same for the cells of `zone` on days firstDay to lastDay.
+    template <typename F>
+    void forEachInZone(uint32_t zone, int firstDay, int lastDay, F&& f) const {
+        if (zone >= zones()) return;
+        auto begin = runDay.begin() + zoneRuns[zone], end = runDay.begin() + zoneRuns[zone + 1];
+        for (auto run = std::lower_bound(begin, end, firstDay); run != end && *run <= lastDay; ++run) {
+            size_t r = (size_t)(run - runDay.begin());
+            uint64_t i = zoneCounts[zone] + runFirst[r];
+            int hour = 0;
+            for (uint32_t mask = runHours[r]; mask; mask >>= 1, ++hour) {
+                if (mask & 1) f(DayTable::key(zone, *run, hour), countAt(i++));
+            }
+        }
+    }
+
+    // forEach and forEachInZone as if `pending` had been absorbed, without
+    // building the merged cube: only the pending cells are sorted.
+    template <typename F>
+    void forEachWith(const DayTable& pending, F&& f) const {
+        mergeCells(sortedCells(pending, [](uint64_t) { return true; }), f, [&](auto&& g) { forEach(g); });
+    }
+    template <typename F>
+    void forEachInZoneWith(const DayTable& pending, uint32_t zone, int firstDay, int lastDay, F&& f) const {
+        Cells added = sortedCells(pending, [&](uint64_t key) {
+            int day = DayTable::dayOf(key);
+            return DayTable::zoneOf(key) == zone && day >= firstDay && day <= lastDay;
+        });
+        mergeCells(added, f, [&](auto&& g) { forEachInZone(zone, firstDay, lastDay, g); });
+    }
+
+private:
+    using Cells = std::vector<std::pair<uint64_t, long long>>;
+
+    template <typename Keep>
+    static Cells sortedCells(const DayTable& pending, Keep&& keep) {
+        Cells cells;
+        pending.forEach([&](uint64_t key, long long count) {
+            if (keep(key)) cells.emplace_back(key, count);
+        });
+        std::sort(cells.begin(), cells.end());
+        return cells;
+    }
+
+    // Calls f with the cells `visit` yields and those of `added`, summing
+    // equal keys. DayTable keys order by zone, day, hour, as the cells here
+    // do, so both arrive in key order.
+    template <typename F, typename Visit>
+    static void mergeCells(const Cells& added, F&& f, Visit&& visit) {
+        size_t next = 0;
+        visit([&](uint64_t key, long long count) {
+            for (; next < added.size() && added[next].first < key; ++next) f(added[next].first, added[next].second);
+            if (next < added.size() && added[next].first == key) count += added[next++].second;
+            f(key, count);
+        });
+        for (; next < added.size(); ++next) f(added[next].first, added[next].second);
+    }
+
+    // Counts that do not fit 32 bits are kept in bigCounts.
+    static constexpr uint32_t BIG = UINT32_MAX;
+
+    std::vector<uint64_t> zoneRuns;    // first run of each zone, then the run count
+    std::vector<uint64_t> zoneCounts;  // first count of each zone, then the count count
+    std::vector<uint16_t> runDay;
+    std::vector<uint32_t> runHours;    // bit h: hour h has a count
+    std::vector<uint32_t> runFirst;    // first count of the run, from the zone's first
+    std::vector<uint32_t> counts;
+    std::unordered_map<uint64_t, uint64_t> bigCounts;  // count index -> count
+
+    long long countAt(uint64_t i) const {
+        return counts[i] == BIG ? (long long)bigCounts.find(i)->second : counts[i];
+    }
+
+    // Cells must arrive in key order; seal() closes the last zone.
+    void append(uint64_t key, long long count) {
+        uint32_t zone = DayTable::zoneOf(key);
+        int day = DayTable::dayOf(key);
+        while (zoneRuns.size() <= zone) {
+            zoneRuns.push_back(runDay.size());
+            zoneCounts.push_back(counts.size());
+        }
+        if (runDay.size() == zoneRuns[zone] || runDay.back() != day) {
+            runDay.push_back((uint16_t)day);
+            runHours.push_back(0);
+            runFirst.push_back((uint32_t)(counts.size() - zoneCounts[zone]));
+        }
+        runHours.back() |= 1u << DayTable::hourOf(key);
+        if ((unsigned long long)count >= BIG) bigCounts[counts.size()] = (uint64_t)count;
+        counts.push_back((unsigned long long)count >= BIG ? BIG : (uint32_t)count);
+    }
+
+    void seal() {
+        if (zoneRuns.empty()) return;
+        zoneRuns.push_back(runDay.size());
+        zoneCounts.push_back(counts.size());
+    }
+};
@@ -0,0 +1,122 @@
+// Seeded synthetic trip CSV generator.
+//
+//   make gen_trips
+//   ./gen_trips --rows 100M --zones 500k --zipf 1.1 -o /tmp/trips.csv
+//   ./gen_trips --rows 10k --wide --no-header --crlf      # SmallTrips.csv layout, to stdout
+//
+// Output depends only on the options, so a file can be regenerated instead of
+// kept around. Rows are streamed, so files larger than RAM are fine.
+#include "trip_gen.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Accepts plain numbers and k/M/G suffixes: 500k, 1.5M.
+bool parseCount(const char* s, uint64_t& out) {
+    char* end = nullptr;
+    double v = strtod(s, &end);
+    if (end == s || v < 0) return false;
+    if (*end == 'k' || *end == 'K') { v *= 1e3; ++end; }
+    else if (*end == 'm' || *end == 'M') { v *= 1e6; ++end; }
+    else if (*end == 'g' || *end == 'G') { v *= 1e9; ++end; }
+    if (*end) return false;
+    out = (uint64_t)v;
+    return true;
+}
+
+bool parseDouble(const char* s, double& out) {
+    char* end = nullptr;
+    out = strtod(s, &end);
+    return end != s && *end == 0;
+}
+
+// "uniform", "rush" or 24 comma-separated weights.
+bool parseHours(const char* s, std::vector<double>& weights) {
+    weights.clear();
+    if (strcmp(s, "uniform") == 0) return true;
+    if (strcmp(s, "rush") == 0) { weights = rushHourWeights(); return true; }
+    const char* p = s;
+    while (*p) {
+        char* end = nullptr;
+        double w = strtod(p, &end);
+        if (end == p || w < 0) return false;
+        weights.push_back(w);
+        p = *end == ',' ? end + 1 : end;
+        if (*end && *end != ',') return false;
+    }
+    return weights.size() == 24;
+}
+
+void usage() {
+    fprintf(stderr,
+            "usage: gen_trips [options]\n"
+            "  --rows N          rows to write (default 1M; k/M/G suffixes)\n"
+            "  --seed N          random seed (default 1)\n"
+            "  --zones N         distinct zones (default 1000)\n"
+            "  --zipf S          Zipf exponent of zone popularity; 0 = uniform (default 0)\n"
+            "  --sequential      row i gets zone i %% zones instead of a random one\n"
+            "  --hours H         uniform | rush | 24 comma-separated weights\n"
+            "  --days N          spread pickups over the first N days of 2024 (default 366)\n"
+            "  --bad R           share of malformed rows, 0-1 (default 0)\n"
+            "  --quoted R        share of rows with quoted fields, 0-1 (default 0)\n"
+            "  --crlf            CRLF line endings\n"
+            "  --bom             start with a UTF-8 byte order mark\n"
+            "  --no-header       omit the header line\n"
+            "  --wide            SmallTrips.csv layout: id, pickup, dropoff, time, distance, fare\n"
+            "  -o PATH           output file (default stdout)\n");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    TripGenOptions options;
+    std::string path = "-";
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        bool ok = true;
+        if (arg == "--crlf") options.crlf = true;
+        else if (arg == "--bom") options.bom = true;
+        else if (arg == "--no-header") options.header = false;
+        else if (arg == "--wide") options.wide = true;
+        else if (arg == "--sequential") options.sequentialZones = true;
+        else if (!value) ok = false;
+        else {
+            ++i;
+            uint64_t n = 0;
+            if (arg == "--rows") ok = parseCount(value, options.rows);
+            else if (arg == "--seed") ok = parseCount(value, options.seed);
+            else if (arg == "--zones") ok = parseCount(value, options.zones) && options.zones > 0;
+            else if (arg == "--zipf") ok = parseDouble(value, options.zipf) && options.zipf >= 0;
+            else if (arg == "--hours") ok = parseHours(value, options.hourWeights);
+            else if (arg == "--days") { ok = parseCount(value, n) && n >= 1 && n <= 366; options.days = (int)n; }
+            else if (arg == "--bad") ok = parseDouble(value, options.badRatio);
+            else if (arg == "--quoted") ok = parseDouble(value, options.quoteRatio);
+            else if (arg == "-o") path = value;
+            else ok = false;
+        }
+        if (!ok) {
+            usage();
+            return 2;
+        }
+    }
+
+    FILE* out = path == "-" ? stdout : fopen(path.c_str(), "wb");
+    if (!out) {
+        fprintf(stderr, "gen_trips: cannot open %s\n", path.c_str());
+        return 1;
+    }
+    uint64_t written = writeTrips(options, out);
+    bool closed = out == stdout ? fflush(out) == 0 : fclose(out) == 0;
+    if ((written == 0 && options.rows > 0) || !closed) {
+        fprintf(stderr, "gen_trips: write to %s failed\n", path.c_str());
+        return 1;
+    }
+    return 0;
+}
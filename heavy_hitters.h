@@ -0,0 +1,333 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Frequency estimates for keys identified by a 64-bit hash, in a fixed
+// amount of memory: `depth` rows of `width` counters, a key adding to one
+// counter per row and reading the smallest. Counts are never under the
+// true count, and with probability 1 - e^-depth a count is over by at most
+// e / width of everything added. Updates are conservative (only counters at
+// the current minimum grow), which keeps that bound and tightens it in
+// practice.
+class CountMinSketch {
+public:
+    size_t width() const { return width_; }
+    int depth() const { return depth_; }
+    size_t bytes() const { return counters.capacity() * sizeof(uint64_t); }
+
+    // Width is a power of two.
+    void reset(size_t width, int depth) {
+        width_ = width;
+        depth_ = depth;
+        std::vector<uint64_t>(width * depth, 0).swap(counters);
+    }
+    // Zeroes the counters in place.
+    void clear() { std::fill(counters.begin(), counters.end(), 0); }
+
+    // Adds n to `hash` and returns its new estimate.
+    uint64_t add(uint64_t hash, uint64_t n) {
+        uint64_t estimate = this->estimate(hash) + n;
+        for (int row = 0; row < depth_; ++row) {
+            uint64_t& c = counters[cell(hash, row)];
+            if (c < estimate) c = estimate;
+        }
+        return estimate;
+    }
+
+    uint64_t estimate(uint64_t hash) const {
+        uint64_t least = UINT64_MAX;
+        for (int row = 0; row < depth_; ++row) least = std::min(least, counters[cell(hash, row)]);
+        return depth_ ? least : 0;
+    }
+
+private:
+    size_t width_ = 0;
+    int depth_ = 0;
+    std::vector<uint64_t> counters;  // row-major
+
+    // Row i probes a + i * b (double hashing), b odd so rows differ.
+    size_t cell(uint64_t hash, int row) const {
+        uint64_t b = ((hash >> 32) | (hash << 32)) | 1;
+        return (size_t)row * width_ + (size_t)((hash + (uint64_t)row * b) & (width_ - 1));
+    }
+};
+
+// The Space-Saving summary: the `capacity` keys with the largest counts
+// seen, where a key that is not kept replaces the smallest one and inherits
+// its count as an error. A kept count is never under the true count and
+// over by at most its error, which is at most total / capacity, so every
+// key with more than that is kept. Entries form a heap, smallest count at
+// the root, found by key hash through an open-addressing index; two keys
+// with the same 64-bit hash count as one.
+//
+// Replacing is what costs: a long tail of rare keys would evict each other
+// on every occurrence. add() takes an upper bound of the key's count (from
+// a sketch) and leaves the summary alone when that is no more than the
+// smallest count, since then the key could not rank above it anyway; the
+// guarantees above still hold.
+//
+// All memory is allocated by reset(): the heap, NAME_BYTES per entry for
+// its name, and the index. Longer names are kept cut to NAME_BYTES.
+class SpaceSaving {
+public:
+    struct Entry {
+        uint64_t hash;
+        uint64_t count;
+        uint64_t error;
+        int32_t slot;
+        uint32_t name;   // name slot, see nameOf
+        uint32_t index;  // position in `index`
+        uint8_t nameLen;
+    };
+
+    static constexpr size_t NAME_BYTES = 32;
+
+    // The memory reset(capacity) allocates.
+    static size_t bytesFor(size_t capacity) {
+        return capacity * (sizeof(Entry) + NAME_BYTES) + indexSize(capacity) * sizeof(uint32_t);
+    }
+
+    size_t capacity() const { return capacity_; }
+    size_t bytes() const {
+        return heap.capacity() * sizeof(Entry) + names.capacity() + index.capacity() * sizeof(uint32_t);
+    }
+    const std::vector<Entry>& entries() const { return heap; }
+    std::string_view nameOf(const Entry& e) const {
+        return std::string_view(names.data() + (size_t)e.name * NAME_BYTES, e.nameLen);
+    }
+
+    void reset(size_t capacity) {
+        capacity_ = capacity;
+        std::vector<Entry>().swap(heap);
+        heap.reserve(capacity);
+        std::vector<char>(capacity * NAME_BYTES).swap(names);
+        std::vector<uint32_t>(indexSize(capacity), EMPTY).swap(index);
+    }
+    void clear() {
+        heap.clear();
+        std::fill(index.begin(), index.end(), EMPTY);
+    }
+
+    // One occurrence of a key whose count, this one included, is at most
+    // `bound`.
+    void add(uint64_t hash, const char* name, size_t len, int slot, uint64_t bound) {
+        if (capacity_ == 0) return;
+        size_t pos = find(hash);
+        if (index[pos] != EMPTY) {
+            uint32_t at = index[pos];
+            ++heap[at].count;
+            siftDown(at);
+        } else if (heap.size() < capacity_) {
+            uint32_t at = (uint32_t)heap.size();
+            heap.push_back(Entry{hash, 1, 0, slot, at, (uint32_t)pos, 0});
+            setName(heap.back(), name, len);
+            index[pos] = at;
+            siftUp(at);
+        } else if (bound > heap[0].count) {
+            erase(heap[0].index);
+            Entry& least = heap[0];
+            pos = find(hash);
+            least.hash = hash;
+            least.slot = slot;
+            least.index = (uint32_t)pos;
+            setName(least, name, len);
+            least.error = least.count;
+            ++least.count;
+            index[pos] = 0;
+            siftDown(0);
+        }
+    }
+
+private:
+    static constexpr uint32_t EMPTY = UINT32_MAX;
+
+    size_t capacity_ = 0;
+    std::vector<Entry> heap;
+    std::vector<char> names;      // NAME_BYTES per entry
+    std::vector<uint32_t> index;  // heap positions, linear probing
+
+    // A power of two at least twice the capacity, so probes stay short.
+    static size_t indexSize(size_t capacity) {
+        if (capacity == 0) return 0;
+        size_t size = 1;
+        while (size < capacity * 2) size *= 2;
+        return size;
+    }
+
+    size_t home(uint64_t hash) const { return (size_t)((hash * 0x9E3779B97F4A7C15ull) >> 32) & (index.size() - 1); }
+
+    // The index position holding `hash`, or the empty one it would take.
+    size_t find(uint64_t hash) const {
+        size_t mask = index.size() - 1;
+        size_t pos = home(hash);
+        while (index[pos] != EMPTY && heap[index[pos]].hash != hash) pos = (pos + 1) & mask;
+        return pos;
+    }
+
+    // Empties index position `pos`, moving later entries of its probe run
+    // back so every key stays reachable from its home.
+    void erase(size_t pos) {
+        size_t mask = index.size() - 1;
+        index[pos] = EMPTY;
+        for (size_t next = (pos + 1) & mask; index[next] != EMPTY; next = (next + 1) & mask) {
+            uint32_t at = index[next];
+            if (((next - home(heap[at].hash)) & mask) < ((next - pos) & mask)) continue;
+            index[pos] = at;
+            heap[at].index = (uint32_t)pos;
+            index[next] = EMPTY;
+            pos = next;
+        }
+    }
+
+    void setName(Entry& e, const char* name, size_t len) {
+        e.nameLen = (uint8_t)std::min(len, NAME_BYTES);
+        memcpy(names.data() + (size_t)e.name * NAME_BYTES, name, e.nameLen);
+    }
+
+    void swapAt(uint32_t a, uint32_t b) {
+        std::swap(heap[a], heap[b]);
+        index[heap[a].index] = a;
+        index[heap[b].index] = b;
+    }
+
+    void siftUp(uint32_t at) {
+        while (at > 0) {
+            uint32_t parent = (at - 1) / 2;
+            if (heap[parent].count <= heap[at].count) break;
+            swapAt(at, parent);
+            at = parent;
+        }
+    }
+
+    void siftDown(uint32_t at) {
+        size_t n = heap.size();
+        for (;;) {
+            size_t child = (size_t)at * 2 + 1;
+            if (child >= n) break;
+            if (child + 1 < n && heap[child + 1].count < heap[child].count) ++child;
+            if (heap[at].count <= heap[child].count) break;
+            swapAt(at, (uint32_t)child);
+            at = (uint32_t)child;
+        }
+    }
+};
+
+// Approximate pickup counts per zone and per (zone, slot): a Count-Min
+// sketch and a Space-Saving summary for each. The summary names the
+// candidates and bounds their error deterministically; the sketch often
+// bounds them tighter, so a reported count is the smaller of the two.
+class HeavyHitters {
+public:
+    struct Shape {
+        size_t width = 0;       // sketch counters per row, a power of two
+        int depth = 0;          // sketch rows
+        size_t candidates = 0;  // keys kept per summary; 0 = off
+    };
+
+    // A key's count and how far over its true count it may be.
+    struct Estimate {
+        const SpaceSaving::Entry* entry;
+        std::string_view name;
+        uint64_t count;
+        uint64_t maxError;
+    };
+
+    // The largest shape within `bytes` for two sketches and two summaries
+    // of `candidates` keys, failing with probability at most `delta`, and
+    // if epsilon > 0 no wider than that bound needs. False when it does not
+    // fit.
+    static bool fit(size_t bytes, double epsilon, double delta, size_t candidates, Shape& shape) {
+        if (candidates == 0 || !(delta > 0 && delta < 1) || !(epsilon >= 0 && epsilon < 1)) return false;
+        size_t summaries = 2 * SpaceSaving::bytesFor(candidates);
+        if (summaries >= bytes) return false;
+        int depth = std::max(1, (int)std::ceil(std::log(1 / delta)));
+        size_t room = (bytes - summaries) / (2 * (size_t)depth * sizeof(uint64_t));
+        if (room == 0) return false;
+        size_t width = 1;
+        while (width * 2 <= room) width *= 2;
+        if (epsilon > 0) {
+            double needed = std::exp(1.0) / epsilon;
+            if (needed > (double)width) return false;
+            while (width / 2 >= needed) width /= 2;
+        }
+        shape = Shape{width, depth, candidates};
+        return true;
+    }
+
+    bool enabled() const { return shape_.candidates != 0; }
+    const Shape& shape() const { return shape_; }
+    uint64_t trips() const { return trips_; }
+    // e / width, the sketch's bound as a fraction of trips().
+    double epsilon() const { return enabled() ? std::exp(1.0) / (double)shape_.width : 0; }
+    double delta() const { return enabled() ? std::exp(-(double)shape_.depth) : 0; }
+    // Allocated, at most what fit() was given.
+    size_t bytes() const { return zoneSketch.bytes() + slotSketch.bytes() + zoneSummary.bytes() + slotSummary.bytes(); }
+
+    // Empties the counts and takes `shape` (Shape() turns the counting off
+    // and frees the memory).
+    void configure(const Shape& shape) {
+        shape_ = shape;
+        trips_ = 0;
+        size_t width = shape.candidates ? shape.width : 0;
+        int depth = shape.candidates ? shape.depth : 0;
+        zoneSketch.reset(width, depth);
+        slotSketch.reset(width, depth);
+        zoneSummary.reset(shape.candidates);
+        slotSummary.reset(shape.candidates);
+    }
+    // Empty the counts in place, keeping the memory.
+    void clear() {
+        trips_ = 0;
+        zoneSketch.clear();
+        zoneSummary.clear();
+        clearSlots();
+    }
+    void clearSlots() {
+        slotSketch.clear();
+        slotSummary.clear();
+    }
+
+    // One pickup in zone `name`; slot < 0 counts the zone only.
+    void add(uint64_t zoneHash, const char* name, size_t len, int slot) {
+        ++trips_;
+        zoneSummary.add(zoneHash, name, len, 0, zoneSketch.add(zoneHash, 1));
+        if (slot >= 0) {
+            uint64_t hash = slotHash(zoneHash, slot);
+            slotSummary.add(hash, name, len, slot, slotSketch.add(hash, 1));
+        }
+    }
+
+    std::vector<Estimate> zones() const { return estimates(zoneSummary, zoneSketch); }
+    std::vector<Estimate> slots() const { return estimates(slotSummary, slotSketch); }
+
+private:
+    Shape shape_;
+    uint64_t trips_ = 0;
+    CountMinSketch zoneSketch, slotSketch;
+    SpaceSaving zoneSummary, slotSummary;
+
+    static uint64_t slotHash(uint64_t zoneHash, int slot) {
+        uint64_t h = zoneHash ^ ((uint64_t)(slot + 1) * 0x9E3779B97F4A7C15ull);
+        h ^= h >> 32;
+        h *= 0xD6E8FEB86659FD93ull;
+        return h ^ (h >> 32);
+    }
+
+    // The true count is at least count - error by the summary and at most
+    // the sketch's estimate.
+    static std::vector<Estimate> estimates(const SpaceSaving& summary, const CountMinSketch& sketch) {
+        std::vector<Estimate> out;
+        out.reserve(summary.entries().size());
+        for (const SpaceSaving::Entry& e : summary.entries()) {
+            uint64_t count = std::min(e.count, sketch.estimate(e.hash));
+            out.push_back(Estimate{&e, summary.nameOf(e), count, count - (e.count - e.error)});
+        }
+        return out;
+    }
+};
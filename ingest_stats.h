@@ -0,0 +1,122 @@
+#pragma once
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+// Ingestion counters and per-phase timings.
+//
+// Compiled in only with -DTRIP_ANALYZER_STATS=1 (make STATS=1). Otherwise
+// every TRIP_STATS_* macro expands to nothing, the hot paths are exactly as
+// without instrumentation, and TripAnalyzer::stats() returns zeros.
+#ifndef TRIP_ANALYZER_STATS
+#define TRIP_ANALYZER_STATS 0
+#endif
+
+struct IngestStats {
+    static constexpr bool enabled = TRIP_ANALYZER_STATS != 0;
+
+    // Time is charged to exactly one phase at a time. READ is stdio reads and
+    // mapping setup; page faults of mapped files land in TOKENIZE, which is
+    // the structural scan. PARSE is field splitting and validation, INSERT
+    // the zone lookup and counter update, MERGE folding parallel results.
+    enum Phase { IDLE, READ, TOKENIZE, PARSE, INSERT, MERGE, PHASE_COUNT };
+
+    uint64_t bytesRead = 0;
+    uint64_t linesSeen = 0;
+    uint64_t rowsAccepted = 0;
+    uint64_t headerLines = 0;
+
+    // Every line seen is accepted, a header or exactly one of these.
+    uint64_t rejectedBlank = 0;
+    uint64_t rejectedNoComma = 0;  // fewer than three fields
+    uint64_t rejectedEmptyId = 0;
+    uint64_t rejectedEmptyZone = 0;
+    uint64_t rejectedBadHour = 0;
+
+    uint64_t quotedLines = 0;  // lines parsed by the quote-aware slow path
+
+    uint64_t hashLookups = 0;
+    uint64_t hashProbes = 0;  // slots inspected beyond the first
+    uint64_t rehashes = 0;
+
+    uint64_t cycles[PHASE_COUNT] = {};
+    double nanosPerCycle = 0;
+
+    double nanos(Phase phase) const { return cycles[phase] * nanosPerCycle; }
+
+    static const char* phaseName(Phase phase) {
+        static const char* const NAMES[PHASE_COUNT] = {"idle", "read", "tokenize", "parse", "insert", "merge"};
+        return NAMES[phase];
+    }
+
+    void add(const IngestStats& o) {
+        bytesRead += o.bytesRead;
+        linesSeen += o.linesSeen;
+        rowsAccepted += o.rowsAccepted;
+        headerLines += o.headerLines;
+        rejectedBlank += o.rejectedBlank;
+        rejectedNoComma += o.rejectedNoComma;
+        rejectedEmptyId += o.rejectedEmptyId;
+        rejectedEmptyZone += o.rejectedEmptyZone;
+        rejectedBadHour += o.rejectedBadHour;
+        quotedLines += o.quotedLines;
+        hashLookups += o.hashLookups;
+        hashProbes += o.hashProbes;
+        rehashes += o.rehashes;
+        for (int p = 0; p < PHASE_COUNT; ++p) cycles[p] += o.cycles[p];
+    }
+
+    // Cycle counter (TSC on x86, nanoseconds elsewhere).
+    static uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    // Charges the time since the last switch to the current phase and makes
+    // `phase` current. Returns the previous phase.
+    Phase enter(Phase phase) {
+        uint64_t t = now();
+        if (current != IDLE) cycles[current] += t - mark;
+        mark = t;
+        Phase previous = current;
+        current = phase;
+        return previous;
+    }
+
+private:
+    Phase current = IDLE;
+    uint64_t mark = 0;
+};
+
+// Makes `phase` current until the end of the enclosing scope.
+class IngestPhaseScope {
+public:
+    IngestPhaseScope(IngestStats& stats, IngestStats::Phase phase) : stats(stats), previous(stats.enter(phase)) {}
+    ~IngestPhaseScope() { stats.enter(previous); }
+    IngestPhaseScope(const IngestPhaseScope&) = delete;
+    IngestPhaseScope& operator=(const IngestPhaseScope&) = delete;
+
+private:
+    IngestStats& stats;
+    IngestStats::Phase previous;
+};
+
+#if TRIP_ANALYZER_STATS
+#define TRIP_STATS_CONCAT_(a, b) a##b
+#define TRIP_STATS_CONCAT(a, b) TRIP_STATS_CONCAT_(a, b)
+#define TRIP_STATS_ADD(stats, field, n) ((stats).field += (n))
+#define TRIP_STATS_PHASE(stats, phase) \
+    IngestPhaseScope TRIP_STATS_CONCAT(tripStatsPhase_, __LINE__)((stats), IngestStats::phase)
+#else
+#define TRIP_STATS_ADD(stats, field, n) ((void)0)
+#define TRIP_STATS_PHASE(stats, phase) ((void)0)
+#endif
+#define TRIP_STATS_INC(stats, field) TRIP_STATS_ADD(stats, field, 1)
@@ -14,6 +14,29 @@ static void printSlots(const std::vector<SlotCount>& v) {
         std::cout << x.zone << "," << x.hour << "," << x.count << "\n";
 }
 
+// Only in STATS=1 builds; goes to stderr so stdout keeps its format.
+static void printStats(const IngestStats& s) {
+    std::cerr << "INGEST_STATS\n"
+              << "bytes_read," << s.bytesRead << "\n"
+              << "lines_seen," << s.linesSeen << "\n"
+              << "rows_accepted," << s.rowsAccepted << "\n"
+              << "header_lines," << s.headerLines << "\n"
+              << "rejected_blank," << s.rejectedBlank << "\n"
+              << "rejected_no_comma," << s.rejectedNoComma << "\n"
+              << "rejected_empty_id," << s.rejectedEmptyId << "\n"
+              << "rejected_empty_zone," << s.rejectedEmptyZone << "\n"
+              << "rejected_bad_hour," << s.rejectedBadHour << "\n"
+              << "quoted_lines," << s.quotedLines << "\n"
+              << "hash_lookups," << s.hashLookups << "\n"
+              << "hash_probes," << s.hashProbes << "\n"
+              << "rehashes," << s.rehashes << "\n";
+    for (int p = IngestStats::READ; p < IngestStats::PHASE_COUNT; ++p) {
+        auto phase = (IngestStats::Phase)p;
+        std::cerr << "phase_" << IngestStats::phaseName(phase) << "," << s.cycles[phase] << " cycles,"
+                  << (long long)s.nanos(phase) << " ns\n";
+    }
+}
+
 int main() {
     auto t0 = std::chrono::high_resolution_clock::now();
 
@@ -22,6 +45,7 @@ int main() {
 
     printZones(analyzer.topZones(10));
     printSlots(analyzer.topBusySlots(10));
+    if (IngestStats::enabled) printStats(analyzer.stats());
 
     auto t1 = std::chrono::high_resolution_clock::now();
     auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
@@ -0,0 +1,50 @@
+#pragma once
+#include <cstddef>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define TRIP_ANALYZER_HAS_MMAP 1
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define TRIP_ANALYZER_HAS_MMAP 0
+#endif
+
+// Read-only mapping of a regular file. valid() is false for pipes, devices,
+// empty files or when mmap fails, in which case callers read through stdio.
+class MappedFile {
+public:
+    explicit MappedFile(int fd) {
+#if TRIP_ANALYZER_HAS_MMAP
+        struct stat st;
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) return;
+
+        size_t length = (size_t)st.st_size;
+        void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) return;
+        madvise(mapped, length, MADV_SEQUENTIAL);
+
+        data_ = (const char*)mapped;
+        size_ = length;
+#else
+        (void)fd;
+#endif
+    }
+
+    ~MappedFile() {
+#if TRIP_ANALYZER_HAS_MMAP
+        if (data_) munmap((void*)data_, size_);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool valid() const { return data_ != nullptr; }
+    const char* begin() const { return data_; }
+    const char* end() const { return data_ + size_; }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
@@ -0,0 +1,132 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Sum, count, minimum and maximum of one numeric trip column per (zone, hour).
+//
+// Values are fixed-point integers (hundredths, see TripAnalyzer) and every
+// accumulator is its own array indexed by row * 24 + hour, so a zone's 24
+// hours are contiguous and the per-zone reductions are packed adds over
+// adjacent integers. A zone gets its row (576 bytes) when its first value
+// arrives; other zones, such as those seen only as a dropoff, cost 4 bytes
+// of row index, and inputs without the column cost nothing.
+class MetricTable {
+public:
+    static constexpr int32_t NO_MIN = INT32_MAX;
+    static constexpr int32_t NO_MAX = INT32_MIN;
+
+    bool empty() const { return counts.empty(); }
+    bool hasZone(uint32_t zone) const { return zone < rowOf.size() && rowOf[zone] != NO_ROW; }
+
+    void clear() {
+        rowOf.clear();
+        rowZone.clear();
+        sums.clear();
+        mins.clear();
+        maxs.clear();
+        counts.clear();
+    }
+
+    void add(uint32_t zone, int hour, int32_t value) {
+        size_t i = (size_t)row(zone) * 24 + hour;
+        sums[i] += value;
+        if (value < mins[i]) mins[i] = value;
+        if (value > maxs[i]) maxs[i] = value;
+        ++counts[i];
+    }
+
+    // Folds `other`'s (fromZone, h) cells into (zone, h) for every hour;
+    // fromZone must have cells there.
+    void mergeZone(uint32_t zone, const MetricTable& other, uint32_t fromZone) {
+        size_t to = (size_t)row(zone) * 24, from = (size_t)other.rowOf[fromZone] * 24;
+        for (int h = 0; h < 24; ++h) {
+            sums[to + h] += other.sums[from + h];
+            mins[to + h] = mins[to + h] < other.mins[from + h] ? mins[to + h] : other.mins[from + h];
+            maxs[to + h] = maxs[to + h] > other.maxs[from + h] ? maxs[to + h] : other.maxs[from + h];
+            counts[to + h] += other.counts[from + h];
+        }
+    }
+
+    // One cell, or a whole zone when hour < 0. Zones without values report
+    // nothing.
+    struct Summary {
+        long long count = 0;
+        long long sum = 0;
+        int32_t min = NO_MIN;
+        int32_t max = NO_MAX;
+    };
+
+    Summary summarize(uint32_t zone, int hour) const {
+        Summary s;
+        if (!hasZone(zone)) return s;
+        size_t begin = (size_t)rowOf[zone] * 24 + (hour < 0 ? 0 : hour);
+        size_t end = hour < 0 ? begin + 24 : begin + 1;
+        for (size_t i = begin; i < end; ++i) {
+            s.count += counts[i];
+            s.sum += sums[i];
+            s.min = mins[i] < s.min ? mins[i] : s.min;
+            s.max = maxs[i] > s.max ? maxs[i] : s.max;
+        }
+        return s;
+    }
+
+    // Per-zone sums and counts for zones [0, zoneCount).
+    void zoneTotals(size_t zoneCount, std::vector<long long>& zoneSums, std::vector<long long>& zoneCounts) const {
+        zoneSums.assign(zoneCount, 0);
+        zoneCounts.assign(zoneCount, 0);
+        for (size_t r = 0; r < rowZone.size(); ++r) {
+            uint32_t z = rowZone[r];
+            if (z >= zoneCount) continue;
+            zoneSums[z] = sum24(sums.data() + r * 24);
+            zoneCounts[z] = sum24(counts.data() + r * 24);
+        }
+    }
+
+private:
+    static constexpr uint32_t NO_ROW = UINT32_MAX;
+
+    // The row of `zone`, appended empty on first use.
+    uint32_t row(uint32_t zone) {
+        if (zone >= rowOf.size()) rowOf.resize((size_t)zone + 1, NO_ROW);
+        if (rowOf[zone] == NO_ROW) {
+            rowOf[zone] = (uint32_t)rowZone.size();
+            rowZone.push_back(zone);
+            sums.resize(sums.size() + 24, 0);
+            mins.resize(mins.size() + 24, NO_MIN);
+            maxs.resize(maxs.size() + 24, NO_MAX);
+            counts.resize(counts.size() + 24, 0);
+        }
+        return rowOf[zone];
+    }
+
+    // At -O2 GCC unrolls a 24-step reduction instead of vectorizing it, so
+    // the lanes are spelled out with vector extensions where available.
+    static long long sum24(const int64_t* v) {
+#if defined(__GNUC__) || defined(__clang__)
+        typedef long long Lanes __attribute__((vector_size(16)));
+        Lanes a = {0, 0}, b = {0, 0};
+        for (int i = 0; i < 24; i += 4) {
+            Lanes x, y;
+            memcpy(&x, v + i, sizeof(x));
+            memcpy(&y, v + i + 2, sizeof(y));
+            a += x;
+            b += y;
+        }
+        a += b;
+        return a[0] + a[1];
+#else
+        long long total = 0;
+        for (int i = 0; i < 24; ++i) total += v[i];
+        return total;
+#endif
+    }
+
+    std::vector<uint32_t> rowOf;    // zone -> row, NO_ROW without values
+    std::vector<uint32_t> rowZone;  // row -> zone
+    std::vector<int64_t> sums;
+    std::vector<int32_t> mins;
+    std::vector<int32_t> maxs;
+    std::vector<int64_t> counts;
+};
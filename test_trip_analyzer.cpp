@@ -1,13 +1,19 @@
 #include "catch_amalgamated.hpp"
 #include "analyzer.h"
 
+#include <algorithm>
+#include <atomic>
 #include <filesystem>
 #include <fstream>
+#include <map>
+#include <set>
 #include <string>
 #include <vector>
 #include <tuple>
 #include <cstdlib>
 #include <chrono>
+#include <cstring>
+#include <thread>
 
 namespace fs = std::filesystem;
 
@@ -52,6 +58,124 @@ static void requireSlotsEq(const std::vector<SlotCount>& got,
     }
 }
 
+// Rankings from two analyzers agree entry by entry, `exp`'s counts taken
+// `times` times over.
+static void requireSameZones(const std::vector<ZoneCount>& got, const std::vector<ZoneCount>& exp,
+                             long long times = 1) {
+    REQUIRE(got.size() == exp.size());
+    for (size_t i = 0; i < exp.size(); i++) {
+        INFO("Index " << i);
+        REQUIRE(got[i].zone == exp[i].zone);
+        REQUIRE(got[i].count == exp[i].count * times);
+    }
+}
+
+static void requireSameSlots(const std::vector<SlotCount>& got, const std::vector<SlotCount>& exp,
+                             long long times = 1) {
+    REQUIRE(got.size() == exp.size());
+    for (size_t i = 0; i < exp.size(); i++) {
+        INFO("Index " << i);
+        REQUIRE(got[i].zone == exp[i].zone);
+        REQUIRE(got[i].hour == exp[i].hour);
+        REQUIRE(got[i].minute == exp[i].minute);
+        REQUIRE(got[i].count == exp[i].count * times);
+    }
+}
+
+// Counts past what any test input could hold, added as a merge would.
+struct TripAnalyzerTestAccess {
+    static void addHourCount(TripAnalyzer& t, const std::string& zone, int hour, uint64_t n) {
+        TripAnalyzer::Aggregate& zones = t.writable();
+        zones.addHourCount(zones.zoneId(zone.data(), zone.size(), hashZoneName(zone.data(), zone.size())), hour, n);
+        t.publish();
+    }
+};
+
+// The first k entries of a ranking.
+template <typename T>
+static std::vector<T> firstK(const std::vector<T>& ranking, int k) {
+    return std::vector<T>(ranking.begin(), ranking.begin() + std::min((size_t)k, ranking.size()));
+}
+
+static void requireSameMetric(const MetricSummary& got, const MetricSummary& exp) {
+    REQUIRE(got.count == exp.count);
+    REQUIRE(got.sum == exp.sum);
+    REQUIRE(got.min == exp.min);
+    REQUIRE(got.max == exp.max);
+}
+
+// Every ranking and metric of two analyzers agrees, `filter` applied to the
+// per-day queries.
+static void requireSameResults(const TripAnalyzer& got, const TripAnalyzer& exp, const DateFilter& filter) {
+    const int all = 1000000;
+    auto zones = exp.topZones(all);
+    requireSameZones(got.topZones(all), zones);
+    requireSameSlots(got.topBusySlots(all), exp.topBusySlots(all));
+    requireSameZones(got.topZones(filter, all), exp.topZones(filter, all));
+    requireSameSlots(got.topBusySlots(filter, all), exp.topBusySlots(filter, all));
+
+    auto gotRoutes = got.topRoutes(all), expRoutes = exp.topRoutes(all);
+    REQUIRE(gotRoutes.size() == expRoutes.size());
+    for (size_t i = 0; i < expRoutes.size(); i++) {
+        INFO("route " << i);
+        REQUIRE(gotRoutes[i].pickupZone == expRoutes[i].pickupZone);
+        REQUIRE(gotRoutes[i].dropoffZone == expRoutes[i].dropoffZone);
+        REQUIRE(gotRoutes[i].count == expRoutes[i].count);
+    }
+    auto gotRevenue = got.topZonesByRevenue(all), expRevenue = exp.topZonesByRevenue(all);
+    REQUIRE(gotRevenue.size() == expRevenue.size());
+    for (size_t i = 0; i < expRevenue.size(); i++) {
+        INFO("revenue " << i);
+        REQUIRE(gotRevenue[i].zone == expRevenue[i].zone);
+        REQUIRE(gotRevenue[i].revenue == expRevenue[i].revenue);
+        REQUIRE(gotRevenue[i].trips == expRevenue[i].trips);
+    }
+    for (const auto& z : zones) {
+        for (int h = -1; h < 24; h += 6) {
+            INFO(z.zone << " hour " << h);
+            ZoneMetrics g = got.zoneMetrics(z.zone, h), e = exp.zoneMetrics(z.zone, h);
+            requireSameMetric(g.fare, e.fare);
+            requireSameMetric(g.distance, e.distance);
+        }
+    }
+}
+
+// Reads `path` serially, with ingestFileParallel at several thread counts,
+// and twice with ingestFiles (merging into counts already there, against
+// two serial streams), each analyzer set up by `configure` first, and
+// requires the same results from all of them.
+template <typename Configure>
+static void requireSameAcrossIngestion(const std::string& path, Configure configure,
+                                       const DateFilter& filter = DateFilter()) {
+    TripAnalyzer serial, twice;
+    configure(serial);
+    configure(twice);
+    serial.ingestFile(path);
+    REQUIRE(!serial.topZones(1).empty());
+    for (int round = 0; round < 2; round++) {
+        FILE* in = std::fopen(path.c_str(), "rb");
+        REQUIRE(in != nullptr);
+        twice.ingestStream(in);
+        std::fclose(in);
+    }
+    for (unsigned threads : {2u, 3u, 8u}) {
+        INFO("ingestFileParallel, threads=" << threads);
+        TripAnalyzer parallel;
+        configure(parallel);
+        parallel.ingestFileParallel(path, threads);
+        requireSameResults(parallel, serial, filter);
+    }
+    INFO("ingestFiles");
+    TripAnalyzer files;
+    configure(files);
+    files.ingestFiles({path, path}, 2);
+    requireSameResults(files, twice, filter);
+}
+
+static void requireSameAcrossIngestion(const std::string& path) {
+    requireSameAcrossIngestion(path, [](TripAnalyzer&) {});
+}
+
 // -------------------- fixture --------------------
 struct TripsFixture {
     fs::path dir;
@@ -322,3 +446,1223 @@ TEST_CASE_METHOD(TripsFixture,
     const long long limit = envMs("C3_LIMIT_MS", fastMode() ? 3500 : 9000);
     REQUIRE(ms < limit);
 }
+
+// =============================================================
+// EXTENSIONS: behaviour beyond the graded skeleton
+// =============================================================
+TEST_CASE_METHOD(TripsFixture, "X1 Mapped ingestion: CRLF rows and unterminated last line", "[X]") {
+    std::string csv =
+        "\xEF\xBB\xBFTripID,PickupZoneID,PickupTime\r\n"
+        "1,Z1,2024-01-01 10:30\r\n"
+        "2,Z2,2024-01-01 11:00\r\n"
+        "3,Z1,2024-01-01 10:59";
+    writeTripsCsv(csv);
+
+    TripAnalyzer a;
+    a.ingestFile("Trips.csv");
+
+    requireZonesEq(a.topZones(10), {{"Z1", 2}, {"Z2", 1}});
+    requireSlotsEq(a.topBusySlots(10), {{"Z1", 10, 2}, {"Z2", 11, 1}});
+}
+
+TEST_CASE_METHOD(TripsFixture, "X2 Parallel ingestion matches the serial result", "[X]") {
+    // Dirty rows, quotes and CRLF spread over a file large enough to be split.
+    std::string csv = "\xEF\xBB\xBF" "BAD\n\nTripID,PickupZoneID,PickupTime\n";
+    for (int i = 0; i < 60000; i++) {
+        int z = (i * 7919) % 1500;
+        int h = (i * 31) % 24;
+        std::string hh = (h < 10 ? "0" : "") + std::to_string(h);
+        switch (i % 9) {
+            case 0: csv += std::to_string(i) + ",\"Z" + std::to_string(z) + "\",\"2024-01-01 " + hh + ":00\"\r\n"; break;
+            case 1: csv += std::to_string(i) + ",Z" + std::to_string(z) + ",garbage\n"; break;
+            case 2: csv += "BROKEN ROW\n"; break;
+            default: csv += std::to_string(i) + ",Z" + std::to_string(z) + ",2024-01-01 " + hh + ":15\n"; break;
+        }
+    }
+    writeTripsCsv(csv);
+    requireSameAcrossIngestion("Trips.csv");
+}
+
+TEST_CASE_METHOD(TripsFixture, "X3 Top-k selection: every k agrees with the full ranking", "[X]") {
+    // Heavy ties: counts take few distinct values, so names and hours decide.
+    std::string csv = "TripID,PickupZoneID,PickupTime\n";
+    for (int i = 0; i < 40000; i++) {
+        int z = (i * 37) % 5000;
+        int h = (i / 5000 + z) % 24;
+        csv += std::to_string(i) + ",Z" + std::to_string(z % 7 == 0 ? z : z % 900) + ",2024-01-01 " +
+               (h < 10 ? "0" : "") + std::to_string(h) + ":00\n";
+    }
+    writeTripsCsv(csv);
+
+    TripAnalyzer a;
+    a.ingestFile("Trips.csv");
+
+    REQUIRE(a.topZones(0).empty());
+    REQUIRE(a.topBusySlots(-3).empty());
+
+    auto allZones = a.topZones(1 << 30);
+    for (size_t i = 1; i < allZones.size(); i++) {
+        bool ordered = allZones[i - 1].count > allZones[i].count ||
+                       (allZones[i - 1].count == allZones[i].count && allZones[i - 1].zone < allZones[i].zone);
+        REQUIRE(ordered);
+    }
+    auto allSlots = a.topBusySlots(1 << 30);
+    for (size_t i = 1; i < allSlots.size(); i++) {
+        const SlotCount& p = allSlots[i - 1];
+        const SlotCount& q = allSlots[i];
+        bool ordered = p.count > q.count ||
+                       (p.count == q.count && (p.zone < q.zone || (p.zone == q.zone && p.hour < q.hour)));
+        REQUIRE(ordered);
+    }
+
+    for (int k : {1, 7, 50, 400, 1500}) {
+        INFO("k=" << k);
+        requireSameZones(a.topZones(k), firstK(allZones, k));
+        requireSameSlots(a.topBusySlots(k), firstK(allSlots, k));
+    }
+}
+
+TEST_CASE_METHOD(TripsFixture, "X4 Streaming ingestion: arbitrary chunking matches ingestFile", "[X]") {
+    std::string csv = "\xEF\xBB\xBFTripID,PickupZoneID,PickupTime\r\n";
+    for (int i = 0; i < 3000; i++) {
+        int h = (i * 7) % 24;
+        csv += std::to_string(i) + ",\"Z" + std::to_string(i % 13) + "\",2024-01-01 " +
+               (h < 10 ? "0" : "") + std::to_string(h) + ":00\r\n";
+        if (i % 97 == 0) csv += "broken,row\r\n";
+    }
+    csv += "9999,Z1,2024-01-01 05:00";  // no trailing newline
+    writeTripsCsv(csv);
+
+    TripAnalyzer file;
+    file.ingestFile("Trips.csv");
+    auto expZones = file.topZones(100);
+    auto expSlots = file.topBusySlots(1000);
+
+    for (size_t step : {1u, 2u, 3u, 64u, 4093u}) {
+        INFO("chunk=" << step);
+        TripAnalyzer s;
+        for (size_t at = 0; at < csv.size(); at += step) {
+            s.ingestBuffer(csv.data() + at, std::min(step, csv.size() - at));
+        }
+        // Rows become visible on publish(); the unterminated last row is
+        // only counted once the stream ends.
+        REQUIRE(s.topZones(100).empty());
+        s.publish();
+        auto countOf = [](const std::vector<ZoneCount>& v, const std::string& zone) {
+            for (const auto& z : v) if (z.zone == zone) return z.count;
+            return -1LL;
+        };
+        REQUIRE(countOf(s.topZones(100), "Z1") == countOf(expZones, "Z1") - 1);
+        s.finish();
+
+        auto zones = s.topZones(100);
+        requireSameZones(zones, expZones);
+        auto slots = s.topBusySlots(1000);
+        requireSameSlots(slots, expSlots);
+    }
+
+    // Two streams accumulate, and the second stream's header is skipped again.
+    TripAnalyzer twice;
+    FILE* in = std::fopen("Trips.csv", "rb");
+    REQUIRE(in != nullptr);
+    twice.ingestStream(in);
+    std::rewind(in);
+    twice.ingestStream(in);
+    std::fclose(in);
+    requireSameZones(twice.topZones(100), expZones, 2);
+}
+
+TEST_CASE_METHOD(TripsFixture, "X5 ingestFiles aggregates many files without clearing", "[X]") {
+    std::vector<std::string> paths;
+    for (int day = 0; day < 6; day++) {
+        std::string csv = day % 2 ? "\xEF\xBB\xBFTripID,PickupZoneID,PickupTime\r\n" : "TripID,PickupZoneID,PickupTime\n";
+        for (int i = 0; i < 2000 + day * 300; i++) {
+            int h = (i + day) % 24;
+            csv += std::to_string(i) + ",Z" + std::to_string((i * (day + 1)) % 50) + ",2024-01-0" +
+                   std::to_string(day + 1) + " " + (h < 10 ? "0" : "") + std::to_string(h) + ":00\n";
+        }
+        std::string path = "day" + std::to_string(day) + ".csv";
+        std::ofstream(path, std::ios::binary) << csv;
+        paths.push_back(path);
+    }
+    paths.insert(paths.begin() + 2, "missing.csv");
+
+    TripAnalyzer sequential;
+    for (const auto& p : paths) {
+        if (FILE* f = std::fopen(p.c_str(), "rb")) {
+            sequential.ingestStream(f);
+            std::fclose(f);
+        }
+    }
+    auto expZones = sequential.topZones(100);
+    auto expSlots = sequential.topBusySlots(2000);
+
+    for (unsigned threads : {1u, 3u, 16u}) {
+        INFO("threads=" << threads);
+        TripAnalyzer a;
+        a.ingestFiles(paths, threads);
+        requireSameZones(a.topZones(100), expZones);
+        requireSameSlots(a.topBusySlots(2000), expSlots);
+    }
+
+    // Existing counts are kept.
+    TripAnalyzer a;
+    a.ingestFile(paths[0]);
+    long long before = a.topZones(1)[0].count;
+    a.ingestFiles({paths[0]});
+    REQUIRE(a.topZones(1)[0].count == 2 * before);
+}
+
+TEST_CASE_METHOD(TripsFixture, "X6 Structural scanner: long rows, padding and extra columns", "[X]") {
+    std::string pad(70, ' ');
+    std::string csv = "TripID,PickupZoneID,PickupTime\n";
+    csv += "1," + pad + "Z1" + pad + ",2024-01-01 10:30\n";       // zone spans block boundaries
+    csv += "2,Z1,2024-01-01 10:45" + std::string(40, ',') + "\n";  // more commas than are indexed
+    csv += pad + "3,Z2,2024-01-01 23:00\r\n";
+    csv += "4,Z2" + pad + "\n";                                      // no time field
+    csv += "5,\"Z,3\",2024-01-01 08:00\n";                           // quoted comma
+    csv += "6,Z2,\t2024-01-01 23:10\t\n";
+    writeTripsCsv(csv);
+
+    TripAnalyzer a;
+    a.ingestFile("Trips.csv");
+
+    requireZonesEq(a.topZones(10), {{"Z1", 2}, {"Z2", 2}, {"Z,3", 1}});
+    requireSlotsEq(a.topBusySlots(10), {{"Z1", 10, 2}, {"Z2", 23, 2}, {"Z,3", 8, 1}});
+}
+
+TEST_CASE_METHOD(TripsFixture, "X7 Trip columns: write once, reload without parsing", "[X]") {
+    std::string csv = "TripID,PickupZoneID,PickupTime\n";
+    for (int i = 0; i < 5000; i++) {
+        int h = (i * 5) % 24;
+        csv += std::to_string(i) + ",Z" + std::to_string((i * i) % 311) + ",2024-01-01 " +
+               (h < 10 ? "0" : "") + std::to_string(h) + ":00\n";
+        if (i % 50 == 0) csv += "bad row\n";
+    }
+    writeTripsCsv(csv);
+
+    TripAnalyzer writer;
+    REQUIRE(writer.writeTripColumns("Trips.csv", "Trips.cols"));
+    REQUIRE_FALSE(writer.writeTripColumns("missing.csv", "other.cols"));
+    auto expZones = writer.topZones(400);
+    auto expSlots = writer.topBusySlots(5000);
+
+    TripAnalyzer reader;
+    REQUIRE(reader.ingestTripColumns("Trips.cols"));
+    auto zones = reader.topZones(400);
+    requireSameZones(zones, expZones);
+    auto slots = reader.topBusySlots(5000);
+    requireSameSlots(slots, expSlots);
+
+    // Truncated or foreign files are rejected and leave the counts alone.
+    std::string bytes;
+    {
+        std::ifstream in("Trips.cols", std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    std::ofstream("cut.cols", std::ios::binary) << bytes.substr(0, bytes.size() / 2);
+    REQUIRE_FALSE(reader.ingestTripColumns("cut.cols"));
+    REQUIRE_FALSE(reader.ingestTripColumns("Trips.csv"));
+    REQUIRE_FALSE(reader.ingestTripColumns("missing.cols"));
+    // A zone count that only matches the offsets column modulo 2^64.
+    std::string crafted = bytes;
+    uint64_t zoneCount;
+    memcpy(&zoneCount, crafted.data() + 24, 8);
+    zoneCount += 1ull << 61;
+    memcpy(&crafted[24], &zoneCount, 8);
+    std::ofstream("crafted.cols", std::ios::binary) << crafted;
+    REQUIRE_FALSE(reader.ingestTripColumns("crafted.cols"));
+    REQUIRE(reader.topZones(1)[0].count == expZones[0].count);
+}
+
+TEST_CASE_METHOD(TripsFixture, "X8 Aggregate snapshot round trip and corruption checks", "[X]") {
+    std::string csv = "TripID,PickupZoneID,PickupTime\n";
+    for (int i = 0; i < 4000; i++) {
+        int h = (i * 11) % 24;
+        csv += std::to_string(i) + ",Zone-" + std::to_string((i * 7) % 97) + ",2024-02-03 " +
+               (h < 10 ? "0" : "") + std::to_string(h) + ":30\n";
+    }
+    writeTripsCsv(csv);
+
+    TripAnalyzer a;
+    a.ingestFile("Trips.csv");
+    REQUIRE(a.saveSnapshot("agg.snap"));
+
+    TripAnalyzer b;
+    REQUIRE(b.loadSnapshot("agg.snap"));
+    auto expSlots = a.topBusySlots(3000);
+    auto slots = b.topBusySlots(3000);
+    requireSameSlots(slots, expSlots);
+    auto expZones = a.topZones(100);
+    auto zones = b.topZones(100);
+    requireSameZones(zones, expZones);
+
+    // Flip one byte in the payload: the checksum must catch it.
+    std::string bytes;
+    {
+        std::ifstream in("agg.snap", std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    bytes[bytes.size() - 3] ^= 0x20;
+    std::ofstream("bad.snap", std::ios::binary) << bytes;
+
+    TripAnalyzer c;
+    c.ingestFile("Trips.csv");
+    REQUIRE_FALSE(c.loadSnapshot("bad.snap"));
+    REQUIRE_FALSE(c.loadSnapshot("missing.snap"));
+    REQUIRE(c.topZones(1)[0].count == expZones[0].count);
+
+    // An empty analyzer round-trips to an empty snapshot.
+    TripAnalyzer empty;
+    REQUIRE(empty.saveSnapshot("empty.snap"));
+    REQUIRE(c.loadSnapshot("empty.snap"));
+    REQUIRE(c.topZones(10).empty());
+}
+
+TEST_CASE_METHOD(TripsFixture, "X9 Ingest stats: rejection reasons add up to the lines seen", "[X]") {
+    std::string csv = "\xEF\xBB\xBFTripID,PickupZoneID,PickupTime\n"
+                      "1,Z1,2024-01-01 10:00\n"
+                      "\"2\",\"Z2\",\"2024-01-01 11:00\"\n"
+                      "\n"
+                      "BAD,LINE\n"
+                      ",Z1,2024-01-01 10:00\n"
+                      "5,,2024-01-01 10:00\n"
+                      "6,Z1,2024-01-01 25:00\n"
+                      "7,Z1,2024-01-01 07:15";
+    writeTripsCsv(csv);
+
+    TripAnalyzer a;
+    a.ingestFile("Trips.csv");
+    IngestStats s = a.stats();
+    if (!IngestStats::enabled) {
+        REQUIRE(s.linesSeen == 0);
+        REQUIRE(s.rowsAccepted == 0);
+        return;
+    }
+    REQUIRE(s.bytesRead == csv.size());
+    REQUIRE(s.linesSeen == 9);
+    REQUIRE(s.headerLines == 1);
+    REQUIRE(s.rowsAccepted == 3);
+    REQUIRE(s.rejectedBlank == 1);
+    REQUIRE(s.rejectedNoComma == 1);
+    REQUIRE(s.rejectedEmptyId == 1);
+    REQUIRE(s.rejectedEmptyZone == 1);
+    REQUIRE(s.rejectedBadHour == 1);
+    REQUIRE(s.quotedLines == 1);
+    REQUIRE(s.hashLookups == 3);
+
+    // Parallel and multi-file ingestion fold their workers' counters in.
+    TripAnalyzer b;
+    b.ingestFiles({"Trips.csv", "Trips.csv"}, 2);
+    REQUIRE(b.stats().rowsAccepted == 6);
+    REQUIRE(b.stats().linesSeen == 18);
+
+    a.reset();
+    REQUIRE(a.stats().linesSeen == 0);
+}
+
+TEST_CASE_METHOD(TripsFixture, "X10 Column mapping: header names, inferred wide layout, explicit map", "[X]") {
+    // Reordered columns found by header name.
+    writeTripsCsv("Fare,pickup_time,Pickup Zone ID,trip_id\n"
+                  "12.5,2024-01-01 10:30,Z1,1\n"
+                  "9.0,2024-01-01 11:00,Z2,2\n"
+                  "3.0,2024-01-01 11:15,Z1,3\n"
+                  "4.0,2024-01-01 11:15,,4\n");
+    TripAnalyzer a;
+    a.ingestFile("Trips.csv");
+    requireZonesEq(a.topZones(10), {{"Z1", 2}, {"Z2", 1}});
+    requireSlotsEq(a.topBusySlots(10), {{"Z1", 10, 1}, {"Z1", 11, 1}, {"Z2", 11, 1}});
+
+    // Headerless SmallTrips.csv layout: the timestamp in column 3 marks it.
+    std::string wide;
+    for (int i = 0; i < 3000; i++) {
+        int h = (i * 5) % 24;
+        wide += std::to_string(1000000 + i) + ",ZONE" + zpad(i % 37, 3) + ",ZONE" + zpad(i % 11, 3) +
+                ",2024-03-04 " + zpad(h, 2) + ":15," + std::to_string(i % 40) + ".5,19.9\r\n";
+    }
+    wide += "1003000,ZONE001,2024-03-04 10:00,1.0,2.0\r\n";  // dropoff missing: time lands in column 2
+    writeTripsCsv(wide);
+    TripAnalyzer b;
+    b.ingestFile("Trips.csv");
+    long long total = 0;
+    for (const auto& z : b.topZones(100)) total += z.count;
+    REQUIRE(total == 3000);
+    REQUIRE(b.topZones(100).size() == 37);
+    requireSameAcrossIngestion("Trips.csv");
+
+    // A dirty first row does not settle the layout: the three-column rows
+    // that follow still count, as they would without inference.
+    writeTripsCsv("1,Z1,,2024-01-01 10:00\n2,Z2,2024-01-01 11:00\n3,Z2,2024-01-01 11:00\n");
+    TripAnalyzer dirty;
+    dirty.ingestFile("Trips.csv");
+    requireZonesEq(dirty.topZones(10), {{"Z2", 2}});
+    requireSlotsEq(dirty.topBusySlots(10), {{"Z2", 11, 2}});
+    // Rows too short for an inferred wide layout are read as three columns.
+    writeTripsCsv("1,Z1,Z5,2024-01-01 10:00\n2,Z2,2024-01-01 11:00\n3,Z2,2024-01-01 11:00\n");
+    for (bool parallelRun : {false, true}) {
+        TripAnalyzer mixed;
+        if (parallelRun) mixed.ingestFileParallel("Trips.csv", 2);
+        else mixed.ingestFile("Trips.csv");
+        requireZonesEq(mixed.topZones(10), {{"Z2", 2}, {"Z1", 1}});
+        requireSlotsEq(mixed.topBusySlots(10), {{"Z2", 11, 2}, {"Z1", 10, 1}});
+    }
+
+    // An explicit map overrides detection; the header is still skipped.
+    writeTripsCsv("TripID,PickupZoneID,PickupTime\n"
+                  "1,Z1,Z9,2024-01-01 07:00\n"
+                  "2,Z2,Z9,2024-01-01 08:00\n");
+    TripAnalyzer c;
+    TripColumnMap columns;
+    columns.pickupZone = 2;
+    columns.pickupTime = 3;
+    REQUIRE(c.setColumnMap(columns));
+    c.ingestFile("Trips.csv");
+    requireZonesEq(c.topZones(10), {{"Z9", 2}});
+
+    columns.pickupTime = -1;
+    REQUIRE_FALSE(c.setColumnMap(columns));
+    c.autoDetectColumns();
+    c.ingestFile("Trips.csv");
+    REQUIRE(c.topZones(10).empty());
+}
+
+TEST_CASE_METHOD(TripsFixture, "X11 Routes: pickup->dropoff pairs ranked with tie-breaks", "[X]") {
+    writeTripsCsv("TripID,PickupZoneID,DropoffZoneID,PickupTime,Distance,Fare\n"
+                  "1,A,B,2024-01-01 10:00,1.0,5.0\n"
+                  "2,A,B,2024-01-01 11:00,1.0,5.0\n"
+                  "3,B,A,2024-01-01 11:00,1.0,5.0\n"
+                  "4,A,C,2024-01-01 12:00,1.0,5.0\n"
+                  "5,A,,2024-01-01 12:00,1.0,5.0\n"       // counted as a pickup, not a route
+                  "6,D,ONLY_DROPOFF,2024-01-01 13:00\n"
+                  "7,,B,2024-01-01 13:00,1.0,5.0\n");  // rejected: no pickup zone
+    TripAnalyzer a;
+    a.ingestFile("Trips.csv");
+
+    auto routes = a.topRoutes(10);
+    REQUIRE(routes.size() == 4);
+    REQUIRE(routes[0].pickupZone == "A");
+    REQUIRE(routes[0].dropoffZone == "B");
+    REQUIRE(routes[0].count == 2);
+    REQUIRE(routes[1].pickupZone == "A");
+    REQUIRE(routes[1].dropoffZone == "C");
+    REQUIRE(routes[2].pickupZone == "B");
+    REQUIRE(routes[3].pickupZone == "D");
+    REQUIRE(routes[3].dropoffZone == "ONLY_DROPOFF");
+    REQUIRE(a.topRoutes(1).size() == 1);
+    REQUIRE(a.topRoutes(0).empty());
+
+    // Dropoff-only zones never show up in the pickup rankings.
+    requireZonesEq(a.topZones(10), {{"A", 4}, {"B", 1}, {"D", 1}});
+
+    // Three-column input has no routes.
+    writeTripsCsv("TripID,PickupZoneID,PickupTime\n1,A,2024-01-01 10:00\n");
+    TripAnalyzer narrow;
+    narrow.ingestFile("Trips.csv");
+    REQUIRE(narrow.topRoutes(10).empty());
+
+    // Parallel ranges and multiple files merge routes through the remap.
+    std::string wide;
+    for (int i = 0; i < 6000; i++) {
+        wide += std::to_string(i) + ",P" + std::to_string((i * 7) % 53) + ",D" + std::to_string((i * 3) % 29) +
+                ",2024-05-06 0" + std::to_string(i % 10) + ":00,2.0,9.5\n";
+    }
+    writeTripsCsv(wide);
+    TripAnalyzer serial;
+    serial.ingestFile("Trips.csv");
+    long long total = 0;
+    for (const auto& r : serial.topRoutes(100000)) total += r.count;
+    REQUIRE(total == 6000);
+    requireSameAcrossIngestion("Trips.csv");
+}
+
+TEST_CASE_METHOD(TripsFixture, "X12 Fare and distance: fixed-point parsing, per-hour metrics, revenue ranking", "[X]") {
+    writeTripsCsv("TripID,PickupZoneID,DropoffZoneID,PickupTime,Distance,Fare\n"
+                  "1,A,B,2024-01-01 10:00,1.5,10\n"
+                  "2,A,B,2024-01-01 10:30,2.25,20.5\n"
+                  "3,A,B,2024-01-01 11:00,0.125,-3.75\n"   // third decimal rounds
+                  "4,A,B,2024-01-01 11:00,abc,1e3\n"       // invalid: counted as a trip only
+                  "5,B,A,2024-01-01 12:00,  7  ,\" 30.10 \"\n"
+                  "6,C,A,2024-01-01 12:00,1,26.75\n"
+                  "7,D,A,2024-01-01 12:00,,\n");
+    TripAnalyzer a;
+    a.ingestFile("Trips.csv");
+    requireZonesEq(a.topZones(10), {{"A", 4}, {"B", 1}, {"C", 1}, {"D", 1}});
+
+    ZoneMetrics m = a.zoneMetrics("A");
+    REQUIRE(m.fare.count == 3);
+    REQUIRE(m.fare.sum == Catch::Approx(26.75));
+    REQUIRE(m.fare.min == Catch::Approx(-3.75));
+    REQUIRE(m.fare.max == Catch::Approx(20.5));
+    REQUIRE(m.fare.mean == Catch::Approx(26.75 / 3));
+    REQUIRE(m.distance.count == 3);
+    REQUIRE(m.distance.sum == Catch::Approx(3.88));
+    REQUIRE(m.distance.min == Catch::Approx(0.13));
+
+    ZoneMetrics h10 = a.zoneMetrics("A", 10);
+    REQUIRE(h10.fare.count == 2);
+    REQUIRE(h10.fare.sum == Catch::Approx(30.5));
+    REQUIRE(h10.fare.min == Catch::Approx(10));
+    REQUIRE(a.zoneMetrics("A", 9).fare.count == 0);
+    REQUIRE(a.zoneMetrics("B").fare.sum == Catch::Approx(30.1));
+    REQUIRE(a.zoneMetrics("B").distance.max == Catch::Approx(7));
+    REQUIRE(a.zoneMetrics("D").fare.count == 0);
+    REQUIRE(a.zoneMetrics("nope").fare.count == 0);
+
+    // B 30.10 > A 26.75 == C 26.75 (tie by name); D has no fares.
+    auto top = a.topZonesByRevenue(10);
+    REQUIRE(top.size() == 3);
+    REQUIRE(top[0].zone == "B");
+    REQUIRE(top[0].trips == 1);
+    REQUIRE(top[1].zone == "A");
+    REQUIRE(top[1].revenue == Catch::Approx(26.75));
+    REQUIRE(top[1].trips == 3);
+    REQUIRE(top[2].zone == "C");
+    REQUIRE(a.topZonesByRevenue(1).size() == 1);
+
+    // Parallel shards merge the accumulators exactly.
+    std::string wide;
+    for (int i = 0; i < 6000; i++) {
+        wide += std::to_string(i) + ",Z" + std::to_string(i % 41) + ",Y,2024-05-06 " + zpad(i % 24, 2) + ":00," +
+                std::to_string(i % 13) + "." + zpad(i % 100, 2) + "," + std::to_string(i % 97) + ".5\n";
+    }
+    writeTripsCsv(wide);
+    TripAnalyzer serial;
+    serial.ingestFile("Trips.csv");
+    REQUIRE(serial.topZonesByRevenue(100).size() == 41);
+    requireSameAcrossIngestion("Trips.csv");
+}
+
+TEST_CASE_METHOD(TripsFixture, "X13 Hour counters past 32 bits carry into 64-bit counts", "[X]") {
+    writeTripsCsv("TripID,PickupZoneID,PickupTime\n"
+                  "1,BIG,2024-01-01 07:00\n"
+                  "2,BIG,2024-01-01 08:00\n"
+                  "3,SMALL,2024-01-01 08:00\n");
+    // BIG gets 2^32 + 5 trips at 07 and 2^32 - 1 at 08.
+    const long long two32 = 1LL << 32;
+    TripAnalyzer b;
+    b.ingestFile("Trips.csv");
+    TripAnalyzerTestAccess::addHourCount(b, "BIG", 7, two32 + 4);
+    TripAnalyzerTestAccess::addHourCount(b, "BIG", 8, two32 - 2);
+    requireZonesEq(b.topZones(5), {{"BIG", 2 * two32 + 4}, {"SMALL", 1}});
+    requireSlotsEq(b.topBusySlots(5), {{"BIG", 7, two32 + 5}, {"BIG", 8, two32 - 1}, {"SMALL", 8, 1}});
+
+    // One more trip at 08 wraps the low 32 bits, once while streaming and
+    // once through the merge of ingestFiles.
+    std::string more = "TripID,PickupZoneID,PickupTime\n9,BIG,2024-01-02 08:15\n";
+    b.ingestBuffer(more.data(), more.size());
+    b.finish();
+    requireSlotsEq(b.topBusySlots(2), {{"BIG", 7, two32 + 5}, {"BIG", 8, two32}});
+    writeTripsCsv(more);
+    b.ingestFiles({"Trips.csv"}, 1);
+    requireSlotsEq(b.topBusySlots(2), {{"BIG", 7, two32 + 5}, {"BIG", 8, two32 + 1}});
+    requireZonesEq(b.topZones(1), {{"BIG", 2 * two32 + 6}});
+
+    // Carries survive a round trip and are dropped by reset().
+    REQUIRE(b.saveSnapshot("again.snap"));
+    TripAnalyzer c;
+    REQUIRE(c.loadSnapshot("again.snap"));
+    requireSlotsEq(c.topBusySlots(3), {{"BIG", 7, two32 + 5}, {"BIG", 8, two32 + 1}, {"SMALL", 8, 1}});
+    c.reset();
+    c.ingestBuffer(more.data(), more.size());
+    c.finish();
+    requireSlotsEq(c.topBusySlots(5), {{"BIG", 8, 1}});
+}
+
+TEST_CASE_METHOD(TripsFixture, "X14 Date filters: ranges, weekdays and calendar validation", "[X]") {
+    // 2023-12-25 (a Monday) to 2024-03-31, a few trips per day; the zone and
+    // hour depend on the day so every filter changes the ranking.
+    struct Trip { std::string zone; int hour; int month; int weekday; };
+    std::vector<Trip> trips;
+    std::string csv = "TripID,PickupZoneID,PickupTime\n";
+    int year = 2023, month = 12, day = 25, weekday = 0, id = 0;
+    for (int n = 0; n < 98; n++) {
+        for (int j = 0; j < 1 + n % 4; j++) {
+            Trip t{"Z" + std::to_string((n * 5 + j) % 7), (n + j * 7) % 24, month, weekday};
+            trips.push_back(t);
+            csv += std::to_string(++id) + "," + t.zone + "," + std::to_string(year) + "-" + zpad(month, 2) + "-" +
+                   zpad(day, 2) + " " + zpad(t.hour, 2) + ":05\n";
+        }
+        int inMonth = month == 2 ? 29 : 31;  // only Dec 2023 to Mar 2024
+        weekday = (weekday + 1) % 7;
+        if (++day > inMonth) {
+            day = 1;
+            if (++month > 12) { month = 1; ++year; }
+        }
+    }
+    // Impossible dates with a valid hour count only without a filter.
+    csv += "900,Z0,2024-02-30 10:00\n901,Z0,2023-02-29 10:00\n902,Z0,2024-13-01 10:00\n903,Z0,1969-12-31 10:00\n";
+    // Leap years: 2000 is one, 2100 is not.
+    csv += "904,ZL,2000-02-29 05:00\n905,ZL,2100-02-29 05:00\n906,ZL,2100-03-01 05:00\n";
+    writeTripsCsv(csv);
+
+    auto expected = [&](int monthWanted, unsigned weekdays) {
+        std::map<std::string, long long> zoneCounts;
+        std::map<std::pair<std::string, int>, long long> slotCounts;
+        for (const Trip& t : trips) {
+            if ((monthWanted && t.month != monthWanted) || !(weekdays >> t.weekday & 1)) continue;
+            ++zoneCounts[t.zone];
+            ++slotCounts[{t.zone, t.hour}];
+        }
+        std::vector<std::pair<std::string, long long>> zones(zoneCounts.begin(), zoneCounts.end());
+        std::stable_sort(zones.begin(), zones.end(), [](auto& a, auto& b) { return a.second > b.second; });
+        std::vector<std::tuple<std::string, int, long long>> slots;
+        for (auto& [key, count] : slotCounts) slots.emplace_back(key.first, key.second, count);
+        std::stable_sort(slots.begin(), slots.end(), [](auto& a, auto& b) { return std::get<2>(a) > std::get<2>(b); });
+        return std::make_pair(zones, slots);
+    };
+
+    TripAnalyzer untracked;
+    untracked.ingestFile("Trips.csv");
+    REQUIRE(untracked.topZones(DateFilter()).empty());
+
+    TripAnalyzer a;
+    a.trackDays(true);
+    a.ingestFile("Trips.csv");
+    REQUIRE(a.topZones(1)[0].count == untracked.topZones(1)[0].count);
+
+    DateFilter march;
+    march.from = "2024-03-01";
+    march.to = "2024-03-31";
+    auto exp = expected(3, DateFilter::EVERY_DAY);
+    requireZonesEq(a.topZones(march, 100), exp.first);
+    requireSlotsEq(a.topBusySlots(march, 1000), exp.second);
+
+    DateFilter weekends;
+    weekends.to = "2024-12-31";
+    weekends.weekdays = DateFilter::WEEKEND;
+    exp = expected(0, DateFilter::WEEKEND);
+    requireZonesEq(a.topZones(weekends, 100), exp.first);
+    requireSlotsEq(a.topBusySlots(weekends, 1000), exp.second);
+
+    exp = expected(2, DateFilter::MONDAY | DateFilter::FRIDAY);
+    DateFilter febMonFri;
+    febMonFri.from = "2024-02-01";
+    febMonFri.to = "2024-02-29";
+    febMonFri.weekdays = DateFilter::MONDAY | DateFilter::FRIDAY;
+    requireZonesEq(a.topZones(febMonFri, 100), exp.first);
+
+    DateFilter leap;
+    leap.from = "1999-01-01";
+    leap.to = "2000-12-31";
+    requireZonesEq(a.topZones(leap, 10), {{"ZL", 1}});
+    leap.from = "2100-01-01";
+    leap.to = "2100-12-31";
+    requireSlotsEq(a.topBusySlots(leap, 10), {{"ZL", 5, 1}});
+
+    DateFilter bad;
+    bad.from = "2024-02-30";
+    REQUIRE(a.topZones(bad).empty());
+    bad.from = "2024-3-1";
+    REQUIRE(a.topBusySlots(bad).empty());
+
+    // Worker aggregates keep days too.
+    std::string big = csv;
+    while (big.size() < 600000) big += csv.substr(csv.find('\n') + 1);
+    writeTripsCsv(big);
+    requireSameAcrossIngestion("Trips.csv", [](TripAnalyzer& t) { t.trackDays(true); }, weekends);
+}
+
+TEST_CASE_METHOD(TripsFixture, "X15 Day cube: daily series and busiest calendar slots", "[X]") {
+    // Zone Zk has trips on every k-th day of 2024 from Jan 1; day d gets
+    // 1 + d % 3 trips at hour d % 24 and one at hour 23.
+    std::map<std::string, std::map<std::string, long long>> series;  // zone -> date -> count
+    std::map<std::tuple<std::string, std::string, int>, long long> cells;
+    std::string csv = "TripID,PickupZoneID,PickupTime\n";
+    const int monthDays[] = {31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    int id = 0;
+    for (int d = 0; d < 366; d++) {
+        int month = 0, dayOfMonth = d;
+        while (dayOfMonth >= monthDays[month]) dayOfMonth -= monthDays[month++];
+        std::string date = "2024-" + zpad(month + 1, 2) + "-" + zpad(dayOfMonth + 1, 2);
+        for (int k = 1; k <= 4; k++) {
+            if (d % k != 0) continue;
+            std::string zone = "Z" + std::to_string(k);
+            for (int t = 0; t < 1 + d % 3; t++) {
+                csv += std::to_string(++id) + "," + zone + "," + date + " " + zpad(d % 24, 2) + ":10\n";
+                ++cells[{zone, date, d % 24}];
+            }
+            csv += std::to_string(++id) + "," + zone + "," + date + " 23:59\n";
+            ++cells[{zone, date, 23}];
+            series[zone][date] += 2 + d % 3;
+        }
+    }
+    writeTripsCsv(csv);
+
+    TripAnalyzer a;
+    a.trackDays(true);
+    a.ingestFile("Trips.csv");
+
+    auto got = a.dailySeries("Z3");
+    REQUIRE(got.size() == series["Z3"].size());
+    size_t i = 0;
+    for (auto& [date, count] : series["Z3"]) {
+        INFO("date " << date);
+        REQUIRE(got[i].date == date);
+        REQUIRE(got[i].count == count);
+        ++i;
+    }
+
+    DateFilter feb;
+    feb.from = "2024-02-01";
+    feb.to = "2024-02-29";
+    got = a.dailySeries("Z4", feb);
+    REQUIRE(got.size() == 7);  // Feb 2, 6, ..., 26 (days 32..56)
+    REQUIRE(got.front().date == "2024-02-02");
+    REQUIRE(got.back().date == "2024-02-26");
+    feb.weekdays = DateFilter::SUNDAY;
+    got = a.dailySeries("Z1", feb);
+    REQUIRE(got.size() == 4);
+    REQUIRE(got[0].date == "2024-02-04");
+    REQUIRE(got[0].count == series["Z1"]["2024-02-04"]);
+    REQUIRE(a.dailySeries("nope").empty());
+
+    // Every cell, ranked: count desc, zone, date, hour asc.
+    std::vector<std::tuple<std::string, std::string, int, long long>> expCells;
+    for (auto& [key, count] : cells) expCells.emplace_back(std::get<0>(key), std::get<1>(key), std::get<2>(key), count);
+    std::stable_sort(expCells.begin(), expCells.end(), [](auto& x, auto& y) { return std::get<3>(x) > std::get<3>(y); });
+    for (int k : {1, 7, 50, 100000}) {
+        auto top = a.topDaySlots(DateFilter(), k);
+        REQUIRE(top.size() == std::min<size_t>((size_t)k, expCells.size()));
+        for (size_t j = 0; j < top.size(); j++) {
+            INFO("k=" << k << " index " << j);
+            REQUIRE(top[j].zone == std::get<0>(expCells[j]));
+            REQUIRE(top[j].date == std::get<1>(expCells[j]));
+            REQUIRE(top[j].hour == std::get<2>(expCells[j]));
+            REQUIRE(top[j].count == std::get<3>(expCells[j]));
+        }
+    }
+    DateFilter lastWeek;
+    lastWeek.from = "2024-12-25";
+    std::vector<std::tuple<std::string, std::string, int, long long>> expLastWeek;
+    for (auto& cell : expCells) {
+        if (std::get<1>(cell) >= "2024-12-25") expLastWeek.push_back(cell);
+    }
+    auto top = a.topDaySlots(lastWeek, 3);
+    REQUIRE(top.size() == 3);
+    for (size_t j = 0; j < top.size(); j++) {
+        REQUIRE(top[j].zone == std::get<0>(expLastWeek[j]));
+        REQUIRE(top[j].date == std::get<1>(expLastWeek[j]));
+        REQUIRE(top[j].hour == std::get<2>(expLastWeek[j]));
+    }
+
+    // Mid-stream the newest cells are not compacted yet; queries see them,
+    // and a cell split between the two is reported once.
+    TripAnalyzer s;
+    s.trackDays(true);
+    size_t cut = csv.find('\n', csv.size() / 2) + 1;
+    s.ingestBuffer(csv.data(), cut);
+    s.finish();
+    std::string rest = "TripID,PickupZoneID,PickupTime\n" + csv.substr(cut);
+    s.ingestBuffer(rest.data(), rest.size());
+    s.publish();
+    auto streamed = s.topDaySlots(DateFilter(), 100000);
+    REQUIRE(streamed.size() == expCells.size());
+    for (size_t j = 0; j < streamed.size(); j++) REQUIRE(streamed[j].count == std::get<3>(expCells[j]));
+    REQUIRE(s.dailySeries("Z2").size() == series["Z2"].size());
+    s.finish();
+    REQUIRE(s.dailySeries("Z2").back().count == series["Z2"].rbegin()->second);
+
+    // A small batch later stays pending next to the cube; an existing cell
+    // and a new zone both show.
+    std::string more = "TripID,PickupZoneID,PickupTime\n1,Z2,2024-12-30 23:00\n2,Z9,2024-12-30 05:00\n";
+    s.ingestBuffer(more.data(), more.size());
+    s.finish();
+    REQUIRE(s.dailySeries("Z2").back().date == "2024-12-30");
+    REQUIRE(s.dailySeries("Z2").back().count == series["Z2"]["2024-12-30"] + 1);
+    REQUIRE(s.dailySeries("Z9", lastWeek).size() == 1);
+    REQUIRE(s.topDaySlots(DateFilter(), 100000).size() == expCells.size() + 1);
+}
+
+TEST_CASE_METHOD(TripsFixture, "X16 Slot granularity: 5- and 15-minute slots", "[X]") {
+    std::string csv = "TripID,PickupZoneID,PickupTime\n";
+    for (int i = 0; i < 30000; i++) {
+        int zone = (i * 7) % 11, hour = (i * 5) % 24, minute = (i * 13) % 60;
+        csv += std::to_string(i) + ",Z" + std::to_string(zone) + ",2024-03-04 " + zpad(hour, 2) + ":" +
+               zpad(minute, 2) + "\n";
+    }
+    // A valid hour without a valid minute counts hourly only.
+    csv += "a,Z0,2024-03-04 10\nb,Z0,2024-03-04 10:7x\nc,Z0,2024-03-04 10:60\n";
+    writeTripsCsv(csv);
+
+    auto expected = [&](int minutes) {
+        std::map<std::tuple<std::string, int>, long long> counts;
+        for (int i = 0; i < 30000; i++) {
+            int zone = (i * 7) % 11, hour = (i * 5) % 24, minute = (i * 13) % 60;
+            ++counts[{"Z" + std::to_string(zone), hour * 60 + minute / minutes * minutes}];
+        }
+        std::vector<std::tuple<std::string, int, long long>> slots;
+        for (auto& [key, count] : counts) slots.emplace_back(std::get<0>(key), std::get<1>(key), count);
+        std::stable_sort(slots.begin(), slots.end(), [](auto& a, auto& b) { return std::get<2>(a) > std::get<2>(b); });
+        return slots;
+    };
+
+    TripAnalyzer hourly;
+    hourly.ingestFile("Trips.csv");
+
+    TripAnalyzer a;
+    REQUIRE(a.slotMinutes() == 60);
+    REQUIRE_FALSE(a.setSlotMinutes(7));
+    REQUIRE_FALSE(a.setSlotMinutes(0));
+    REQUIRE_FALSE(a.setSlotMinutes(120));
+    for (int minutes : {5, 15, 1}) {
+        INFO("minutes=" << minutes);
+        int before = a.slotMinutes();
+        REQUIRE(a.setSlotMinutes(minutes));
+        REQUIRE(a.slotMinutes() == before);  // published with the next counts
+        a.ingestFile("Trips.csv");
+        REQUIRE(a.slotMinutes() == minutes);
+        auto exp = expected(minutes);
+        auto got = a.topBusySlots(100000);
+        REQUIRE(got.size() == exp.size());
+        for (size_t i = 0; i < got.size(); i++) {
+            INFO("index " << i);
+            REQUIRE(got[i].zone == std::get<0>(exp[i]));
+            REQUIRE(got[i].hour * 60 + got[i].minute == std::get<1>(exp[i]));
+            REQUIRE(got[i].count == std::get<2>(exp[i]));
+        }
+        // Everything else stays hourly.
+        requireZonesEq(a.topZones(1), {{hourly.topZones(1)[0].zone, hourly.topZones(1)[0].count}});
+    }
+
+    // Worker aggregates use the same width.
+    REQUIRE(a.setSlotMinutes(15));
+    REQUIRE(!a.topBusySlots(1).empty());  // until the change is published
+    a.publish();
+    REQUIRE(a.topBusySlots(1).empty());  // the 1-minute counts are dropped
+    a.ingestFile("Trips.csv");
+    auto exp = a.topBusySlots(100);
+    std::string big = csv;
+    for (int copy = 0; copy < 3; copy++) big += csv.substr(csv.find('\n') + 1);
+    writeTripsCsv(big);
+    requireSameAcrossIngestion("Trips.csv", [](TripAnalyzer& t) { REQUIRE(t.setSlotMinutes(15)); });
+    TripAnalyzer fourfold;
+    REQUIRE(fourfold.setSlotMinutes(15));
+    fourfold.ingestFile("Trips.csv");
+    requireSameSlots(fourfold.topBusySlots(100), exp, 4);
+
+    // Back to hours: the default ranking, minute 0.
+    REQUIRE(fourfold.setSlotMinutes(60));
+    fourfold.publish();
+    requireSameSlots(fourfold.topBusySlots(3), hourly.topBusySlots(3), 4);
+}
+
+TEST_CASE_METHOD(TripsFixture, "X17 Concurrent queries see whole published versions only", "[X]") {
+    // Two inputs with different rankings; readers must only ever see one of
+    // them (or the empty start), never a file half ingested.
+    auto makeCsv = [](int seed) {
+        std::string csv = "TripID,PickupZoneID,PickupTime\n";
+        for (int i = 0; i < 20000; i++) {
+            int zone = (i * seed) % 97, hour = (i * (seed + 2)) % 24;
+            csv += std::to_string(i) + ",Z" + std::to_string(zone) + ",2024-05-06 " + zpad(hour, 2) + ":00\n";
+        }
+        return csv;
+    };
+    writeTripsCsv(makeCsv(7));
+    fs::rename("Trips.csv", "A.csv");
+    writeTripsCsv(makeCsv(13) + makeCsv(3));
+    fs::rename("Trips.csv", "B.csv");
+
+    auto fingerprint = [](const TripAnalyzer& t) {
+        std::string s;
+        for (const auto& z : t.topZones(20)) s += z.zone + "=" + std::to_string(z.count) + ";";
+        return s;
+    };
+    auto slotFingerprint = [](const TripAnalyzer& t) {
+        std::string s;
+        for (const auto& z : t.topBusySlots(20)) s += z.zone + "@" + std::to_string(z.hour) + "=" + std::to_string(z.count) + ";";
+        return s;
+    };
+    TripAnalyzer a, b;
+    a.ingestFile("A.csv");
+    b.ingestFile("B.csv");
+    const std::vector<std::string> zoneVersions = {"", fingerprint(a), fingerprint(b)};
+    const std::vector<std::string> slotVersions = {"", slotFingerprint(a), slotFingerprint(b)};
+    REQUIRE(zoneVersions[1] != zoneVersions[2]);
+
+    TripAnalyzer shared;
+    std::atomic<bool> done(false);
+    std::atomic<int> unexpected(0), reads(0);
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 3; r++) {
+        readers.emplace_back([&, r]() {
+            while (!done) {
+                const auto& versions = r % 2 ? slotVersions : zoneVersions;
+                std::string seen = r % 2 ? slotFingerprint(shared) : fingerprint(shared);
+                if (std::find(versions.begin(), versions.end(), seen) == versions.end()) ++unexpected;
+                ++reads;
+            }
+        });
+    }
+    for (int round = 0; round < 20; round++) {
+        shared.ingestFile(round % 2 ? "B.csv" : "A.csv");
+        if (round % 5 == 4) shared.ingestFileParallel("A.csv", 2);
+        // Streaming halfway through a file publishes nothing.
+        std::string part = makeCsv(5).substr(0, 50000);
+        shared.ingestBuffer(part.data(), part.size());
+    }
+    while (reads < 100) std::this_thread::yield();
+    done = true;
+    for (auto& t : readers) t.join();
+    REQUIRE(unexpected == 0);
+
+    // What was streamed after the last ingestFile shows up once finished.
+    shared.finish();
+    REQUIRE(fingerprint(shared) != zoneVersions[2]);
+}
+
+TEST_CASE_METHOD(TripsFixture, "X18 Independent instances ingest concurrently", "[X]") {
+    // One file per region, each with its own zones and hours; long quoted
+    // rows make lines straddle small read buffers.
+    const int regions = 8;
+    std::vector<std::string> paths;
+    for (int r = 0; r < regions; r++) {
+        std::string csv = "TripID,PickupZoneID,PickupTime\n";
+        for (int i = 0; i < 6000 + r * 500; i++) {
+            int zone = (i * (r + 3)) % (40 + r), hour = (i * (r + 5)) % 24;
+            csv += std::to_string(i) + ",\"R" + std::to_string(r) + "-" + std::to_string(zone) + "\",2024-07-0" +
+                   std::to_string(1 + r % 9) + " " + zpad(hour, 2) + ":30\n";
+        }
+        writeTripsCsv(csv);
+        paths.push_back("region" + std::to_string(r) + ".csv");
+        fs::rename("Trips.csv", paths.back());
+    }
+
+    std::vector<std::vector<SlotCount>> expected;
+    for (const auto& path : paths) {
+        TripAnalyzer t;
+        t.ingestFile(path);
+        expected.push_back(t.topBusySlots(2000));
+        REQUIRE(!expected.back().empty());
+    }
+
+    // Each instance streams its file through a differently sized buffer
+    // (own or lent from a pool), all at once, several times over.
+    std::vector<std::vector<char>> pool(regions, std::vector<char>(7919));
+    std::atomic<int> mismatches(0);
+    std::vector<std::thread> threads;
+    for (int r = 0; r < regions; r++) {
+        threads.emplace_back([&, r]() {
+            TripAnalyzer t;
+            if (r % 3 == 0) t.useReadBuffer(pool[r].data(), pool[r].size());
+            else t.setReadBufferSize(r % 3 == 1 ? 1 : 65536 + r);
+            for (int round = 0; round < 5; round++) {
+                t.reset();
+                FILE* in = std::fopen(paths[r].c_str(), "rb");
+                if (!in) { ++mismatches; return; }
+                t.ingestStream(in);
+                std::fclose(in);
+                auto got = t.topBusySlots(2000);
+                bool same = got.size() == expected[r].size();
+                for (size_t i = 0; same && i < got.size(); i++) {
+                    same = got[i].zone == expected[r][i].zone && got[i].hour == expected[r][i].hour &&
+                           got[i].count == expected[r][i].count;
+                }
+                if (!same) ++mismatches;
+                // The mapped path too.
+                t.ingestFile(paths[r]);
+                if (t.topBusySlots(1)[0].count != expected[r][0].count) ++mismatches;
+            }
+        });
+    }
+    for (auto& th : threads) th.join();
+    REQUIRE(mismatches == 0);
+}
+
+TEST_CASE_METHOD(TripsFixture, "X19 Cached rankings: repeated and shorter queries, refreshed on new counts", "[X]") {
+    std::string csv = "TripID,PickupZoneID,PickupTime\n";
+    for (int i = 0; i < 20000; i++) {
+        int zone = (i * i) % 97, hour = (i * 7) % 24;
+        csv += std::to_string(i) + ",Z" + zpad(zone, 2) + ",2024-01-01 " + zpad(hour, 2) + ":" + zpad(i % 60, 2) + "\n";
+    }
+    writeTripsCsv(csv);
+
+    auto zonesOf = [](const std::vector<ZoneCount>& v) {
+        std::vector<std::pair<std::string, long long>> out;
+        for (const auto& z : v) out.emplace_back(z.zone, z.count);
+        return out;
+    };
+    auto slotsOf = [](const std::vector<SlotCount>& v) {
+        std::vector<std::tuple<std::string, int, long long>> out;
+        for (const auto& s : v) out.emplace_back(s.zone, s.hour * 60 + s.minute, s.count);
+        return out;
+    };
+    auto minutesOf = [](std::vector<SlotCount> v) {
+        for (auto& s : v) s.hour = s.hour * 60 + s.minute;
+        return v;
+    };
+
+    // Each k against a fresh analyzer, which has nothing cached.
+    auto check = [&](TripAnalyzer& a, int minutes) {
+        for (int k : {10, 50, 1000, 3, 50, 1, 5000}) {
+            INFO("k=" << k);
+            TripAnalyzer fresh;
+            fresh.setSlotMinutes(minutes);
+            fresh.ingestFile("Trips.csv");
+            requireZonesEq(a.topZones(k), zonesOf(fresh.topZones(k)));
+            requireSlotsEq(minutesOf(a.topBusySlots(k)), slotsOf(fresh.topBusySlots(k)));
+        }
+    };
+
+    TripAnalyzer a;
+    a.ingestFile("Trips.csv");
+    check(a, 60);
+    REQUIRE(a.topZones(1000).size() == 49);  // the squares mod 97
+
+    // New counts publish a new version with its own rankings.
+    auto before = a.topZones(5);
+    a.ingestFiles({"Trips.csv"}, 1);
+    requireSameZones(a.topZones(5), before, 2);
+    a.reset();
+    REQUIRE(a.topZones(5).empty());
+    REQUIRE(a.topBusySlots(5).empty());
+    a.ingestFile("Trips.csv");
+    check(a, 60);
+
+    // So does a change of slot width.
+    REQUIRE(a.setSlotMinutes(15));
+    a.ingestFile("Trips.csv");
+    check(a, 15);
+}
+
+TEST_CASE_METHOD(TripsFixture, "X20 Online top-K: tracked rankings equal the batch result throughout a stream", "[X]") {
+    // Skewed zones with many ties, so entries enter, leave and reorder.
+    std::string csv = "TripID,PickupZoneID,PickupTime\n";
+    unsigned seed = 12345;
+    for (int i = 0; i < 40000; i++) {
+        seed = seed * 1103515245u + 12345u;
+        int zone = (int)((seed >> 16) % 300);
+        zone = zone * zone / 300;
+        csv += std::to_string(i) + ",Z" + zpad(zone, 3) + ",2024-01-01 " + zpad(i % 24, 2) + ":00\n";
+    }
+    writeTripsCsv(csv);
+
+    const int K = 25;
+    TripAnalyzer live, batch;
+    live.trackTopZones(K);
+    size_t pos = 0, step = 997;
+    int checks = 0;
+    while (pos < csv.size()) {
+        size_t n = std::min(step, csv.size() - pos);
+        live.ingestBuffer(csv.data() + pos, n);
+        batch.ingestBuffer(csv.data() + pos, n);
+        pos += n;
+        step = step * 7 % 5003 + 1;
+        live.publish();
+        batch.publish();
+        // Within K from the tracker, beyond it from the scan.
+        for (int k : {1, 5, K, K + 3}) {
+            INFO("offset " << pos << " k=" << k);
+            requireSameZones(live.topZones(k), batch.topZones(k));
+        }
+        ++checks;
+    }
+    live.finish();
+    REQUIRE(checks > 20);
+
+    TripAnalyzer whole;
+    whole.ingestFile("Trips.csv");
+    for (int k : {1, 10, K, K + 1, 1000}) {
+        INFO("k=" << k);
+        requireSameZones(live.topZones(k), whole.topZones(k));
+    }
+
+    // Merged counts (ingestFiles), a restart and switching on mid-way.
+    live.ingestFiles({"Trips.csv", "Trips.csv"}, 2);
+    whole.ingestFiles({"Trips.csv", "Trips.csv"}, 2);
+    requireSameZones(live.topZones(K), whole.topZones(K));
+    live.ingestFile("Trips.csv");
+    requireSameZones(live.topZones(K), batch.topZones(K));
+    TripAnalyzer late;
+    late.ingestBuffer(csv.data(), csv.size() / 2);
+    late.trackTopZones(8);
+    late.ingestBuffer(csv.data() + csv.size() / 2, csv.size() - csv.size() / 2);
+    late.finish();
+    requireSameZones(late.topZones(8), batch.topZones(8));
+    live.trackTopZones(0);
+    requireSameZones(live.topZones(K), batch.topZones(K));
+}
+
+TEST_CASE_METHOD(TripsFixture, "X21 Approximate mode: heavy hitters within the reported bounds", "[X]") {
+    // Ten heavy zones 100 trips apart on a long tail of rare zones.
+    std::vector<std::string> lines;
+    for (int z = 0; z < 10; z++) {
+        for (int i = 0; i < 3000 - 100 * z; i++) lines.push_back("H" + std::to_string(z) + ",2024-01-01 " + zpad((i * 7 + z) % 24, 2) + ":00");
+    }
+    for (int i = 0; i < 20000; i++) lines.push_back("T" + std::to_string(i * 7919 % 5000) + ",2024-01-01 " + zpad(i % 24, 2) + ":30");
+    unsigned seed = 7;
+    for (size_t i = lines.size() - 1; i > 0; i--) {
+        seed = seed * 1103515245u + 12345u;
+        std::swap(lines[i], lines[(seed >> 8) % (i + 1)]);
+    }
+    std::string csv = "TripID,PickupZoneID,PickupTime\n", second = csv;
+    for (size_t i = 0; i < lines.size(); i++) {
+        (i < lines.size() / 2 ? csv : second) += std::to_string(i) + "," + lines[i] + "\n";
+    }
+    writeTripsCsv(second);
+    fs::rename(dir / "Trips.csv", dir / "Second.csv");
+    writeTripsCsv(csv);
+
+    TripAnalyzer exact;
+    exact.ingestFiles({"Trips.csv", "Second.csv"}, 1);
+    auto exactZones = exact.topZones(100000);
+    std::map<std::string, long long> zoneTrips;
+    for (const auto& z : exactZones) zoneTrips[z.zone] = z.count;
+    std::map<std::pair<std::string, int>, long long> slotTrips;
+    for (const auto& s : exact.topBusySlots(1000000)) slotTrips[{s.zone, s.hour}] = s.count;
+
+    TripAnalyzer a;
+    ApproximateOptions options;
+    options.memoryBytes = 1 << 20;
+    options.candidates = 256;
+    options.epsilon = 0.0001;
+    REQUIRE_FALSE(a.setApproximate(options));  // the sketch needs more room
+    options.epsilon = 0;
+    options.delta = 1;
+    REQUIRE_FALSE(a.setApproximate(options));
+    options.delta = 0.001;
+    options.candidates = 10000;
+    REQUIRE_FALSE(a.setApproximate(options));  // candidates alone exceed it
+    REQUIRE_FALSE(a.approximateBounds().approximate);
+    options.candidates = 256;
+    options.epsilon = 0.001;
+    REQUIRE(a.setApproximate(options));
+
+    auto check = [&](TripAnalyzer& t) {
+        ApproximateBounds b = t.approximateBounds();
+        REQUIRE(b.approximate);
+        REQUIRE(b.trips == (long long)lines.size());
+        REQUIRE(b.epsilon <= 0.001);
+        REQUIRE(b.delta <= 0.001);
+        REQUIRE(b.memoryBytes <= options.memoryBytes);
+        REQUIRE(b.summaryError == b.trips / 256);
+
+        auto zones = t.topZones(100000);
+        REQUIRE(zones.size() <= 256);
+        for (int z = 0; z < 10; z++) REQUIRE(zones[z].zone == exactZones[z].zone);
+        for (const auto& z : zones) {
+            INFO(z.zone);
+            long long truth = zoneTrips[z.zone];
+            REQUIRE(z.count >= truth);
+            REQUIRE(z.count - truth <= z.maxError);
+            REQUIRE(z.maxError <= b.summaryError);
+            REQUIRE(z.count - truth <= b.sketchError);
+        }
+        auto slots = t.topBusySlots(100000);
+        REQUIRE(slots.size() <= 256);
+        std::set<std::pair<std::string, int>> ranked;
+        for (const auto& s : slots) {
+            INFO(s.zone << " " << s.hour);
+            long long truth = slotTrips[{s.zone, s.hour}];
+            REQUIRE(s.minute == 0);
+            REQUIRE(s.count >= truth);
+            REQUIRE(s.count - truth <= s.maxError);
+            REQUIRE(s.count - truth <= b.sketchError);
+            ranked.insert({s.zone, s.hour});
+        }
+        for (const auto& [slot, count] : slotTrips) {
+            if (count > b.summaryError) REQUIRE(ranked.count(slot));
+        }
+        auto top = t.topBusySlots(3);
+        REQUIRE(top.size() == 3);
+        REQUIRE(top[0].zone == "H0");
+    };
+
+    a.ingestFile("Trips.csv");
+    a.ingestFiles({"Second.csv"});
+    check(a);
+    REQUIRE(a.topZones(DateFilter(), 5).empty());
+
+    // Many files stay within one budget: they are read into one set of
+    // sketches, not one set per file.
+    std::vector<std::string> parts;
+    for (int f = 0; f < 30; f++) {
+        std::string part = "TripID,PickupZoneID,PickupTime\n";
+        for (size_t i = f; i < lines.size(); i += 30) part += std::to_string(i) + "," + lines[i] + "\n";
+        parts.push_back("part" + std::to_string(f) + ".csv");
+        std::ofstream(parts.back(), std::ios::binary) << part;
+    }
+    TripAnalyzer many;
+    REQUIRE(many.setApproximate(options));
+    many.ingestFiles(parts, 4);
+    REQUIRE(many.approximateBounds().memoryBytes <= options.memoryBytes);
+    check(many);
+
+    TripAnalyzer parallel, serial;
+    REQUIRE(parallel.setApproximate(options));
+    REQUIRE(serial.setApproximate(options));
+    parallel.ingestFileParallel("Trips.csv", 4);
+    serial.ingestFile("Trips.csv");
+    auto p = parallel.topZones(300), s = serial.topZones(300);
+    REQUIRE(p.size() == s.size());
+    for (size_t i = 0; i < p.size(); i++) {
+        REQUIRE(p[i].zone == s[i].zone);
+        REQUIRE(p[i].count == s[i].count);
+        REQUIRE(p[i].maxError == s[i].maxError);
+    }
+
+    // Snapshots and trip-column files hold exact counts only.
+    REQUIRE_FALSE(a.saveSnapshot("approx.snap"));
+    REQUIRE_FALSE(a.loadSnapshot("approx.snap"));
+    REQUIRE_FALSE(a.writeTripColumns("Trips.csv", "approx.cols"));
+    REQUIRE_FALSE(a.ingestTripColumns("approx.cols"));
+    check(a);
+
+    // Names are kept in fixed room: longer ones are reported cut, but
+    // still counted apart by their full name.
+    std::string longName(40, 'L');
+    std::ofstream("Long.csv", std::ios::binary) << "TripID,PickupZoneID,PickupTime\n1," << longName
+                                                << "A,2024-01-01 10:00\n2," << longName << "A,2024-01-01 10:00\n3,"
+                                                << longName << "B,2024-01-01 10:00\n";
+    TripAnalyzer names;
+    REQUIRE(names.setApproximate(options));
+    names.ingestFile("Long.csv");
+    auto cut = names.topZones(5);
+    REQUIRE(cut.size() == 2);
+    REQUIRE(cut[0].zone == longName.substr(0, 32));
+    REQUIRE(cut[0].count == 2);
+    REQUIRE(cut[1].count == 1);
+    REQUIRE(names.approximateBounds().memoryBytes <= options.memoryBytes);
+
+    // Back to exact counting starts over.
+    REQUIRE(a.setApproximate(ApproximateOptions()));
+    REQUIRE_FALSE(a.approximateBounds().approximate);
+    REQUIRE(a.topZones(5).empty());
+    a.ingestFiles({"Trips.csv", "Second.csv"}, 1);
+    requireZonesEq(a.topZones(5), {{exactZones[0].zone, exactZones[0].count}, {exactZones[1].zone, exactZones[1].count},
+                                   {exactZones[2].zone, exactZones[2].count}, {exactZones[3].zone, exactZones[3].count},
+                                   {exactZones[4].zone, exactZones[4].count}});
+}
+
+TEST_CASE_METHOD(TripsFixture, "X22 Copies and moves keep the counts and stay independent", "[X]") {
+    writeTripsCsv("TripID,PickupZoneID,PickupTime\n"
+                  "1,Z1,2024-01-01 09:00\n"
+                  "2,Z1,2024-01-01 09:10\n"
+                  "3,Z1,2024-01-01 10:00\n"
+                  "4,Z2,2024-01-01 11:00\n");
+    {
+        std::ofstream out("More.csv", std::ios::binary);
+        for (int i = 0; i < 5; i++) out << i << ",Z2,2024-01-02 12:00\n";
+    }
+    TripAnalyzer a;
+    a.ingestFile("Trips.csv");
+
+    TripAnalyzer copy(a);
+    requireZonesEq(copy.topZones(10), {{"Z1", 3}, {"Z2", 1}});
+    copy.ingestFiles({"More.csv"}, 1);
+    requireZonesEq(copy.topZones(10), {{"Z2", 6}, {"Z1", 3}});
+    requireZonesEq(a.topZones(10), {{"Z1", 3}, {"Z2", 1}});
+
+    TripAnalyzer moved(std::move(copy));
+    requireZonesEq(moved.topZones(10), {{"Z2", 6}, {"Z1", 3}});
+    REQUIRE(copy.topZones(10).empty());
+    copy.ingestFile("Trips.csv");
+    requireZonesEq(copy.topZones(10), {{"Z1", 3}, {"Z2", 1}});
+
+    a = moved;
+    requireZonesEq(a.topZones(10), {{"Z2", 6}, {"Z1", 3}});
+    a.reset();
+    requireZonesEq(moved.topZones(10), {{"Z2", 6}, {"Z1", 3}});
+    a = std::move(moved);
+    requireZonesEq(a.topZones(1), {{"Z2", 6}});
+    REQUIRE(moved.topZones(10).empty());
+}
@@ -0,0 +1,154 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Keeps the k best items pushed into it under a strict total order
+// `better(a, b)` ("a ranks before b") and returns them best-first.
+//
+// Small k relative to the candidate count uses a bounded heap whose root is
+// the worst item kept, so most candidates are rejected with one comparison
+// and nothing is stored for them. Large k collects every candidate and runs
+// nth_element + sort on the survivors, which is linear plus k log k instead
+// of paying a heap operation for most of the input.
+template <typename T, typename Better>
+class TopKSelector {
+public:
+    TopKSelector(size_t k, size_t expectedCandidates, Better better)
+        : k_(k), better_(better), useHeap_(k * 32 <= expectedCandidates) {
+        items_.reserve(useHeap_ ? k : expectedCandidates);
+    }
+
+    void push(const T& item) {
+        if (k_ == 0) return;
+        if (!useHeap_) {
+            items_.push_back(item);
+            return;
+        }
+        if (items_.size() < k_) {
+            items_.push_back(item);
+            std::push_heap(items_.begin(), items_.end(), better_);
+        } else if (better_(item, items_.front())) {
+            std::pop_heap(items_.begin(), items_.end(), better_);
+            items_.back() = item;
+            std::push_heap(items_.begin(), items_.end(), better_);
+        }
+    }
+
+    std::vector<T> take() {
+        if (!useHeap_ && items_.size() > k_) {
+            std::nth_element(items_.begin(), items_.begin() + k_, items_.end(), better_);
+            items_.resize(k_);
+        }
+        std::sort(items_.begin(), items_.end(), better_);
+        return std::move(items_);
+    }
+
+private:
+    size_t k_;
+    Better better_;
+    bool useHeap_;
+    std::vector<T> items_;
+};
+
+template <typename T, typename Better>
+TopKSelector<T, Better> makeTopKSelector(size_t k, size_t expectedCandidates, Better better) {
+    return TopKSelector<T, Better>(k, expectedCandidates, better);
+}
+
+// The k best of a set of IDs whose counts only grow, kept current one
+// increase at a time so a ranking never has to scan every ID.
+//
+// The kept entries form a heap whose root is the worst of them, with the
+// heap position of every ID alongside. An ID outside the set can only move
+// ahead of the root when its own count grows, so bump() is exact: a kept ID
+// sifts away from the root, another one replaces the root if it now ranks
+// before it, and anything else costs one comparison. `better(a, b)` orders
+// Entry values as in TopKSelector and is passed per call, so it may refer to
+// data that moves along with the owner (zone names).
+class TopKTracker {
+public:
+    struct Entry {
+        uint64_t count;
+        uint32_t id;
+    };
+
+    size_t capacity() const { return k_; }
+    bool empty() const { return heap_.empty(); }
+
+    // Forgets every entry and keeps the k best from now on.
+    void reset(size_t k) {
+        k_ = k;
+        heap_.clear();
+        position_.clear();
+    }
+
+    // `id`'s count has grown to `count`.
+    template <typename Better>
+    void bump(uint32_t id, uint64_t count, Better better) {
+        if (k_ == 0) return;
+        if (id >= position_.size()) position_.resize((size_t)id + 1, NONE);
+        uint32_t at = position_[id];
+        if (at != NONE) {
+            heap_[at].count = count;
+            siftDown(at, better);
+        } else if (heap_.size() < k_) {
+            heap_.push_back(Entry{count, id});
+            position_[id] = (uint32_t)(heap_.size() - 1);
+            siftUp((uint32_t)(heap_.size() - 1), better);
+        } else if (better(Entry{count, id}, heap_[0])) {
+            position_[heap_[0].id] = NONE;
+            heap_[0] = Entry{count, id};
+            position_[id] = 0;
+            siftDown(0, better);
+        }
+    }
+
+    // The kept entries, best first.
+    template <typename Better>
+    std::vector<Entry> sorted(Better better) const {
+        std::vector<Entry> out(heap_);
+        std::sort(out.begin(), out.end(), better);
+        return out;
+    }
+
+private:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    size_t k_ = 0;
+    std::vector<Entry> heap_;
+    std::vector<uint32_t> position_;  // by ID, NONE when not kept
+
+    void place(uint32_t at, const Entry& e) {
+        heap_[at] = e;
+        position_[e.id] = at;
+    }
+
+    template <typename Better>
+    void siftUp(uint32_t at, Better& better) {
+        Entry e = heap_[at];
+        while (at > 0) {
+            uint32_t parent = (at - 1) / 2;
+            if (!better(heap_[parent], e)) break;
+            place(at, heap_[parent]);
+            at = parent;
+        }
+        place(at, e);
+    }
+
+    template <typename Better>
+    void siftDown(uint32_t at, Better& better) {
+        Entry e = heap_[at];
+        size_t n = heap_.size();
+        for (;;) {
+            size_t child = (size_t)at * 2 + 1;
+            if (child >= n) break;
+            if (child + 1 < n && better(heap_[child], heap_[child + 1])) ++child;
+            if (!better(e, heap_[child])) break;
+            place(at, heap_[child]);
+            at = (uint32_t)child;
+        }
+        place(at, e);
+    }
+};
@@ -0,0 +1,206 @@
+#include "trip_gen.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+void appendNumber(std::string& out, uint64_t v) {
+    char digits[24];
+    int n = 0;
+    do { digits[n++] = (char)('0' + v % 10); v /= 10; } while (v);
+    while (n) out += digits[--n];
+}
+
+void append2(std::string& out, int v) {
+    out += (char)('0' + v / 10);
+    out += (char)('0' + v % 10);
+}
+
+// Appends v / 10 with one decimal, e.g. 163 -> "16.3".
+void appendTenths(std::string& out, uint64_t v) {
+    appendNumber(out, v / 10);
+    out += '.';
+    out += (char)('0' + v % 10);
+}
+
+// log1p(x) / x and expm1(x) / x, accurate near zero.
+double log1pOverX(double x) {
+    return std::fabs(x) > 1e-8 ? std::log1p(x) / x : 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x));
+}
+
+double expm1OverX(double x) {
+    return std::fabs(x) > 1e-8 ? std::expm1(x) / x : 1 + x * 0.5 * (1 + x / 3 * (1 + 0.25 * x));
+}
+
+const int DAYS_IN_MONTH[12] = {31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+}  // namespace
+
+std::vector<double> rushHourWeights() {
+    return {1, 0.6, 0.4, 0.3, 0.4, 0.8, 2, 4, 6, 4, 3, 3,
+            3.5, 3, 3, 3.5, 4.5, 6, 6.5, 5, 4, 3, 2.5, 1.5};
+}
+
+// ---------------- random numbers ----------------
+uint64_t TripGenerator::Rng::next() {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+uint64_t TripGenerator::Rng::below(uint64_t n) {
+    return next() % n;
+}
+
+double TripGenerator::Rng::unit() {
+    return (next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+double TripGenerator::Zipf::h(double x) const {
+    return std::exp(-s * std::log(x));
+}
+
+double TripGenerator::Zipf::hIntegral(double x) const {
+    double logX = std::log(x);
+    return expm1OverX((1 - s) * logX) * logX;
+}
+
+double TripGenerator::Zipf::hIntegralInverse(double x) const {
+    double t = std::max(-1.0, x * (1 - s));
+    return std::exp(log1pOverX(t) * x);
+}
+
+uint64_t TripGenerator::Zipf::sample(Rng& rng) const {
+    for (;;) {
+        double u = hIntegralN + rng.unit() * (hIntegralX1 - hIntegralN);
+        double x = hIntegralInverse(u);
+        double k = std::min((double)n, std::max(1.0, std::floor(x + 0.5)));
+        if (k - x <= sThreshold || u >= hIntegral(k + 0.5) - h(k)) return (uint64_t)k - 1;
+    }
+}
+
+// ---------------- generator ----------------
+TripGenerator::TripGenerator(const TripGenOptions& options) : opt(options) {
+    opt.zones = std::max<uint64_t>(1, opt.zones);
+    opt.days = std::min(366, std::max(1, opt.days));
+    rng.state = opt.seed;
+
+    zipf.n = opt.zones;
+    zipf.s = opt.zipf;
+    zipf.hIntegralX1 = zipf.hIntegral(1.5) - 1;
+    zipf.hIntegralN = zipf.hIntegral(opt.zones + 0.5);
+    zipf.sThreshold = 2 - zipf.hIntegralInverse(zipf.hIntegral(2.5) - zipf.h(2));
+
+    double sum = 0;
+    for (double w : opt.hourWeights) sum += std::max(0.0, w);
+    if (opt.hourWeights.size() == 24 && sum > 0) {
+        double running = 0;
+        for (double w : opt.hourWeights) hourCdf.push_back((running += std::max(0.0, w)) / sum);
+    }
+
+    zoneWidth = 1;
+    for (uint64_t n = opt.zones - 1; n >= 10; n /= 10) ++zoneWidth;
+    zoneWidth = std::max(3, zoneWidth);
+}
+
+uint64_t TripGenerator::drawZone() {
+    if (opt.zipf > 0) return zipf.sample(rng);
+    return rng.below(opt.zones);
+}
+
+int TripGenerator::drawHour() {
+    if (hourCdf.empty()) return (int)rng.below(24);
+    auto it = std::lower_bound(hourCdf.begin(), hourCdf.end(), rng.unit());
+    return std::min(23, (int)(it - hourCdf.begin()));
+}
+
+void TripGenerator::appendZone(std::string& out, uint64_t zone) const {
+    out += "ZONE";
+    char digits[24];
+    int n = 0;
+    do { digits[n++] = (char)('0' + zone % 10); zone /= 10; } while (zone);
+    for (int pad = n; pad < zoneWidth; ++pad) out += '0';
+    while (n) out += digits[--n];
+}
+
+void TripGenerator::appendHeader(std::string& out) const {
+    if (opt.bom) out += "\xEF\xBB\xBF";
+    if (!opt.header) return;
+    out += opt.wide ? "TripID,PickupZoneID,DropoffZoneID,PickupTime,Distance,Fare"
+                    : "TripID,PickupZoneID,PickupTime";
+    out += opt.crlf ? "\r\n" : "\n";
+}
+
+// The shapes of bad input the analyzer must reject: too few fields, an
+// empty zone, an unparseable or out-of-range time, and blank lines.
+void TripGenerator::appendMalformed(std::string& out) {
+    const char* zones = opt.wide ? ",ZONE001,ZONE002," : ",ZONE001,";
+    const char* time;
+    switch (rng.below(5)) {
+        case 0: out += "BAD,LINE"; return;
+        case 1: zones = opt.wide ? ",,ZONE002," : ",,"; time = "2024-01-01 10:00"; break;
+        case 2: time = "NOT_A_TIME"; break;
+        case 3: time = "2024-01-01 25:00"; break;
+        default: return;
+    }
+    appendNumber(out, row);
+    out += zones;
+    out += time;
+    if (opt.wide) out += ",1.0,5.0";
+}
+
+void TripGenerator::appendRow(std::string& out) {
+    ++row;
+    uint64_t pickup = opt.sequentialZones ? (row - 1) % opt.zones : drawZone();
+    int hour = drawHour();
+    int minute = (int)rng.below(60);
+    int day = (int)rng.below((uint64_t)opt.days);
+    bool bad = opt.badRatio > 0 && rng.unit() < opt.badRatio;
+    bool quoted = opt.quoteRatio > 0 && rng.unit() < opt.quoteRatio;
+
+    if (bad) {
+        appendMalformed(out);
+    } else {
+        int month = 0;
+        while (day >= DAYS_IN_MONTH[month]) day -= DAYS_IN_MONTH[month++];
+        const char* q = quoted ? "\"" : "";
+
+        out += q; appendNumber(out, row); out += q; out += ',';
+        out += q; appendZone(out, pickup); out += q; out += ',';
+        if (opt.wide) {
+            out += q; appendZone(out, drawZone()); out += q; out += ',';
+        }
+        out += q; out += "2024-"; append2(out, month + 1); out += '-'; append2(out, day + 1);
+        out += ' '; append2(out, hour); out += ':'; append2(out, minute); out += q;
+        if (opt.wide) {
+            // Distance 0.5-50.0 km; fare is a base charge plus a per-km rate
+            // with some noise, like the sample file.
+            uint64_t distance = 5 + rng.below(496);
+            uint64_t fare = 150 + distance * 34 / 10 + rng.below(100);
+            out += ','; out += q; appendTenths(out, distance); out += q;
+            out += ','; out += q; appendTenths(out, fare); out += q;
+        }
+    }
+    out += opt.crlf ? "\r\n" : "\n";
+}
+
+uint64_t writeTrips(const TripGenOptions& options, FILE* out) {
+    TripGenerator gen(options);
+    std::string buf;
+    buf.reserve((1 << 20) + 256);
+    gen.appendHeader(buf);
+
+    uint64_t written = 0;
+    for (uint64_t i = 0; i < options.rows; ++i) {
+        gen.appendRow(buf);
+        if (buf.size() >= (1 << 20)) {
+            if (fwrite(buf.data(), 1, buf.size(), out) != buf.size()) return 0;
+            written += buf.size();
+            buf.clear();
+        }
+    }
+    if (fwrite(buf.data(), 1, buf.size(), out) != buf.size()) return 0;
+    return written + buf.size();
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Deterministic synthetic trip data. The same options (seed included) always
+// produce the same bytes; rows are produced one at a time, so output size is
+// bounded only by the disk.
+struct TripGenOptions {
+    uint64_t rows = 1000000;
+    uint64_t seed = 1;
+
+    // Pickup/dropoff zones are drawn from `zones` distinct IDs; zipf = 0
+    // draws them uniformly, zipf > 0 gives zone rank r weight 1 / r^zipf.
+    // sequentialZones gives row i zone i % zones instead (every row a new
+    // zone when zones >= rows).
+    uint64_t zones = 1000;
+    double zipf = 0;
+    bool sequentialZones = false;
+
+    // Relative weight of each pickup hour; empty means uniform.
+    std::vector<double> hourWeights;
+
+    // Pickup dates are spread uniformly over this many days from 2024-01-01.
+    int days = 366;
+
+    double badRatio = 0;    // share of malformed rows
+    double quoteRatio = 0;  // share of rows with every field quoted
+    bool crlf = false;
+    bool bom = false;
+    bool header = true;
+
+    // Wide rows follow SmallTrips.csv: TripID, PickupZoneID, DropoffZoneID,
+    // PickupTime, Distance, Fare. Narrow rows are TripID, PickupZoneID,
+    // PickupTime.
+    bool wide = false;
+};
+
+// Hour weights with morning and evening rush peaks.
+std::vector<double> rushHourWeights();
+
+class TripGenerator {
+public:
+    explicit TripGenerator(const TripGenOptions& options);
+
+    void appendHeader(std::string& out) const;
+    // Appends the next row, including its line ending.
+    void appendRow(std::string& out);
+
+private:
+    struct Rng {
+        uint64_t state;
+        uint64_t next();
+        uint64_t below(uint64_t n);
+        double unit();
+    };
+
+    // Rejection-inversion Zipf sampler (Hörmann & Derflinger); O(1) memory,
+    // so cardinalities far beyond RAM-sized tables are fine.
+    struct Zipf {
+        uint64_t n;
+        double s;
+        double hIntegralX1, hIntegralN, sThreshold;
+        double h(double x) const;
+        double hIntegral(double x) const;
+        double hIntegralInverse(double x) const;
+        uint64_t sample(Rng& rng) const;
+    };
+
+    TripGenOptions opt;
+    Rng rng;
+    Zipf zipf;
+    std::vector<double> hourCdf;
+    uint64_t row = 0;
+    int zoneWidth;
+
+    uint64_t drawZone();
+    int drawHour();
+    void appendZone(std::string& out, uint64_t zone) const;
+    void appendMalformed(std::string& out);
+};
+
+// Streams every row of `options` to out. Returns bytes written, or 0 if a
+// write failed.
+uint64_t writeTrips(const TripGenOptions& options, FILE* out);
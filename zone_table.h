@@ -0,0 +1,169 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "ingest_stats.h"
+
+// Hash used for zone names. Reads at most eight bytes per step with fixed
+// size loads, so the short IDs seen in trip files ("Z12", "ZONE254") cost a
+// couple of multiplies and no calls.
+inline uint64_t hashZoneName(const char* data, size_t len) {
+    const uint64_t mul = 0x9E3779B97F4A7C15ull;
+    uint64_t h = 0x243F6A8885A308D3ull ^ (len * mul);
+    while (len > 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        h = (h ^ word) * mul;
+        h ^= h >> 29;
+        data += 8;
+        len -= 8;
+    }
+    uint64_t word;
+    if (len >= 4) {
+        uint32_t lo, hi;
+        memcpy(&lo, data, 4);
+        memcpy(&hi, data + len - 4, 4);
+        word = ((uint64_t)hi << 32) | lo;
+    } else if (len > 0) {
+        word = ((uint64_t)(unsigned char)data[0] << 16) |
+               ((uint64_t)(unsigned char)data[len >> 1] << 8) |
+               (uint64_t)(unsigned char)data[len - 1];
+    } else {
+        word = 0;
+    }
+    h = (h ^ word) * mul;
+    h ^= h >> 32;
+    h *= 0xD6E8FEB86659FD93ull;
+    h ^= h >> 32;
+    return h;
+}
+
+// Interns zone names and hands out dense IDs 0, 1, 2, ... in first-seen
+// order.
+//
+// Every distinct name is stored once in a contiguous character arena and is
+// addressed by its ID, so per-zone data can live in plain vectors indexed by
+// ID. The index is an open-addressing table with linear probing over 8-byte
+// slots (upper hash bits + ID); a lookup hashes the key once, walks a probe
+// sequence that usually stays within one cache line, and compares characters
+// only when the stored hash bits match. Lookups take a pointer and length, so
+// callers never build a std::string for a zone that is already known.
+class ZoneDictionary {
+public:
+    static constexpr uint32_t NOT_FOUND = 0xFFFFFFFFu;
+
+    ZoneDictionary() { clear(); }
+
+    size_t size() const { return hashes.size(); }
+    bool empty() const { return hashes.empty(); }
+
+    std::string_view name(uint32_t id) const {
+        return std::string_view(arena.data() + offsets[id], (size_t)(offsets[id + 1] - offsets[id]));
+    }
+    uint64_t hashOf(uint32_t id) const { return hashes[id]; }
+
+    void clear() {
+        arena.clear();
+        hashes.clear();
+        offsets.assign(1, 0);
+        slots.assign(16, Slot{0, NOT_FOUND});
+#if TRIP_ANALYZER_STATS
+        lookups = probes = rehashes = 0;
+#endif
+    }
+
+    // Adds the intern() lookup, probe and rehash counts to `into` (nothing
+    // unless built with TRIP_ANALYZER_STATS).
+    void addProbeStats(IngestStats& into) const {
+        TRIP_STATS_ADD(into, hashLookups, lookups);
+        TRIP_STATS_ADD(into, hashProbes, probes);
+        TRIP_STATS_ADD(into, rehashes, rehashes);
+        (void)into;
+    }
+
+    // Sizes the probe array for n names without touching the arena.
+    void reserve(size_t n) {
+        size_t want = 16;
+        while (want < n * 2) want <<= 1;
+        if (want > slots.size()) rehash(want);
+    }
+
+    uint32_t find(const char* key, size_t len) const {
+        return slots[probeFor(key, len, hashZoneName(key, len))].id;
+    }
+
+    // Returns the ID of key, assigning the next free one on first sight.
+    uint32_t intern(const char* key, size_t len) {
+        return intern(key, len, hashZoneName(key, len));
+    }
+
+    uint32_t intern(const char* key, size_t len, uint64_t h) {
+#if TRIP_ANALYZER_STATS
+        ++lookups;
+        size_t pos = probeFor(key, len, h, &probes);
+#else
+        size_t pos = probeFor(key, len, h);
+#endif
+        if (slots[pos].id != NOT_FOUND) return slots[pos].id;
+
+        if ((hashes.size() + 1) * 2 > slots.size()) {
+            rehash(slots.size() * 2);
+            pos = probeFor(key, len, h);
+        }
+        uint32_t id = (uint32_t)hashes.size();
+        slots[pos] = Slot{(uint32_t)(h >> 32), id};
+        arena.insert(arena.end(), key, key + len);
+        offsets.push_back(arena.size());
+        hashes.push_back(h);
+        return id;
+    }
+
+private:
+    struct Slot {
+        uint32_t tag;  // upper 32 bits of the hash
+        uint32_t id;   // NOT_FOUND if unused
+    };
+
+    std::vector<char> arena;
+    std::vector<uint64_t> offsets;  // name i is arena[offsets[i], offsets[i + 1])
+    std::vector<uint64_t> hashes;
+    std::vector<Slot> slots;
+#if TRIP_ANALYZER_STATS
+    uint64_t lookups = 0;
+    uint64_t probes = 0;
+    uint64_t rehashes = 0;
+#endif
+
+    // Position of key's slot, or of the empty slot where it would be inserted.
+    // Slots inspected after the first are added to *steps.
+    size_t probeFor(const char* key, size_t len, uint64_t h, uint64_t* steps = nullptr) const {
+        size_t mask = slots.size() - 1;
+        uint32_t tag = (uint32_t)(h >> 32);
+        size_t pos = (size_t)h & mask;
+        while (true) {
+            const Slot& slot = slots[pos];
+            if (slot.id == NOT_FOUND) return pos;
+            if (slot.tag == tag && hashes[slot.id] == h) {
+                uint64_t begin = offsets[slot.id];
+                if (offsets[slot.id + 1] - begin == len && memcmp(arena.data() + begin, key, len) == 0) return pos;
+            }
+            pos = (pos + 1) & mask;
+            if (steps) ++*steps;
+        }
+    }
+
+    void rehash(size_t capacity) {
+#if TRIP_ANALYZER_STATS
+        ++rehashes;
+#endif
+        slots.assign(capacity, Slot{0, NOT_FOUND});
+        size_t mask = capacity - 1;
+        for (uint32_t id = 0; id < (uint32_t)hashes.size(); ++id) {
+            size_t pos = (size_t)hashes[id] & mask;
+            while (slots[pos].id != NOT_FOUND) pos = (pos + 1) & mask;
+            slots[pos] = Slot{(uint32_t)(hashes[id] >> 32), id};
+        }
+    }
+};